@@ -0,0 +1,139 @@
+#include "opfinder.h"
+#include "scoresort.h"
+#include "mappedfile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+/*
+    Microbenchmarks of the main paths over a TSV of label and score columns, e.g. written
+    by ScoreGenerator. Every run measures a single benchmark, so peak RSS is its own:
+        OptimalThresholdBench <benchmark> <input> [repeats] [threads]
+    Benchmarks: read, sort, calculate, data, plot, optimal. Timing is the best of the
+    repeats, setup isn't timed. Bytes are the input size, except for sort, where they are the
+    size of sorted scores, and for data and plot, where they are the size of the output.
+    Results are printed as a JSON line, see `make bench`.
+*/
+
+static const char* DATA_FORMAT = "%T\t%p\t%d\t%r\t%t\t%f\t%a\t%n\t%F";
+
+static size_t CountLines(const std::string& fileName, size_t& bytes) {
+    TMappedFile file;
+    if (!file.Open(fileName))
+        throw std::runtime_error("Can't map input file " + fileName);
+    bytes = file.Size();
+    size_t lines = 0;
+    for (const char* p = file.Begin(); (p = (const char*)memchr(p, '\n', file.End() - p)); ++p)
+        ++lines;
+    return lines;
+}
+
+static std::vector<double> ReadScores(const std::string& fileName) {
+    TMappedFile file;
+    if (!file.Open(fileName))
+        throw std::runtime_error("Can't map input file " + fileName);
+    std::vector<double> scores;
+    const char* p = file.Begin();
+    while (p < file.End()) {
+        const char* tab = (const char*)memchr(p, '\t', file.End() - p);
+        if (!tab)
+            break;
+        scores.push_back(strtod(tab + 1, nullptr));
+        const char* newLine = (const char*)memchr(tab, '\n', file.End() - tab);
+        p = newLine ? newLine + 1 : file.End();
+    }
+    return scores;
+}
+
+static size_t FileSize(const std::string& fileName) {
+    struct stat info;
+    return (stat(fileName.c_str(), &info) == 0) ? info.st_size : 0;
+}
+
+static std::string TempFileName() {
+    const char* directory = getenv("TMPDIR");
+    std::string fileName = std::string(directory ? directory : "/tmp") + "/otf-bench-XXXXXX";
+    int fd = mkstemp(&fileName[0]);
+    if (fd < 0)
+        throw std::runtime_error("Can't create temporary file");
+    close(fd);
+    return fileName;
+}
+
+//Best time of the repeats in seconds, setup runs before every repeat and isn't timed
+static double Measure(size_t repeats, const std::function<void()>& setup, const std::function<void()>& run) {
+    double best = 0;
+    for (size_t i = 0; i < repeats; ++i) {
+        setup();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!i || (seconds < best))
+            best = seconds;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: OptimalThresholdBench <read|sort|calculate|data|plot|optimal> <input> [repeats] [threads]" << std::endl;
+        return 1;
+    }
+    std::string benchmark = argv[1];
+    std::string inputFileName = argv[2];
+    size_t repeats = (argc > 3) ? std::max(atoi(argv[3]), 1) : 3;
+    size_t threads = (argc > 4) ? atoi(argv[4]) : 1;
+
+    size_t inputBytes;
+    size_t rows = CountLines(inputFileName, inputBytes);
+    size_t bytes = inputBytes;
+    double seconds = 0;
+
+    TOpFinder finder(0, 1, 1, 0);
+    finder.SetThreadCount(threads);
+    std::function<void()> none = []() {};
+    if (benchmark == "read") {
+        seconds = Measure(repeats, none, [&]() { finder.ReadFromStream(inputFileName); });
+    } else if (benchmark == "sort") {
+        std::vector<double> original = ReadScores(inputFileName);
+        std::vector<double> scores;
+        bytes = original.size() * sizeof(double);
+        seconds = Measure(repeats, [&]() { scores = original; }, [&]() { SortScores(scores, threads); });
+    } else {
+        finder.ReadFromStream(inputFileName);
+        finder.Calculate();
+        if (benchmark == "calculate") {
+            seconds = Measure(repeats, none, [&]() { finder.Calculate(); });
+        } else if ((benchmark == "data") || (benchmark == "plot")) {
+            std::string outputFileName = TempFileName();
+            if (benchmark == "data")
+                seconds = Measure(repeats, none, [&]() { finder.WriteDataToFile(outputFileName, DATA_FORMAT); });
+            else
+                seconds = Measure(repeats, none, [&]() { finder.WritePlotToFile(outputFileName, "fpr", "tpr", 100000, 1e-4); });
+            bytes = FileSize(outputFileName);
+            unlink(outputFileName.c_str());
+        } else if (benchmark == "optimal") {
+            seconds = Measure(repeats, none, [&]() { finder.FindOptimalThreshold("prc", "tpr", 0.8); });
+        } else {
+            std::cerr << "Unknown benchmark " << benchmark << std::endl;
+            return 1;
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"benchmark\": \"%s\", \"rows\": %zu, \"bytes\": %zu, \"threads\": %zu, \"seconds\": %.6f, "
+           "\"rows_per_second\": %.0f, \"bytes_per_second\": %.0f, \"peak_rss_kb\": %ld}\n",
+           benchmark.c_str(), rows, bytes, threads, seconds,
+           seconds > 0 ? rows / seconds : 0.0, seconds > 0 ? bytes / seconds : 0.0, usage.ru_maxrss);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include "bootstrap.h"
+
+#include <math.h>
+#include <algorithm>
+
+static const size_t INVERSION_MAX_MEAN = 64;   //bigger means are sampled by std::poisson_distribution
+
+TPoissonSampler::TPoissonSampler(uint64_t seed, size_t replicate) {
+    std::seed_seq sequence = {(uint32_t)seed, (uint32_t)(seed >> 32), (uint32_t)replicate, (uint32_t)((uint64_t)replicate >> 32)};
+    Generator.seed(sequence);
+}
+
+double TPoissonSampler::Uniform() {
+    return (double)(Generator() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+size_t TPoissonSampler::Sample(double mean) {
+    static const std::vector<double> zeroProbability = []() {
+        std::vector<double> result(INVERSION_MAX_MEAN + 1);
+        for (size_t i = 0; i < result.size(); ++i)
+            result[i] = exp(-(double)i);
+        return result;
+    }();
+
+    if (!(mean > 0))
+        return 0;
+    if (mean > INVERSION_MAX_MEAN)
+        return std::poisson_distribution<size_t>(mean)(Generator);
+
+    //inversion of CDF, takes mean + 1 steps on average
+    double u = Uniform();
+    double p = (mean == floor(mean)) ? zeroProbability[(size_t)mean] : exp(-mean);
+    double cdf = p;
+    size_t k = 0;
+    while ((u > cdf) && (p > 0)) {
+        ++k;
+        p *= mean / (double)k;
+        cdf += p;
+    }
+    return k;
+}
+
+double Percentile(std::vector<double>& values, double q) {
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    double rank = q * (double)(values.size() - 1);
+    size_t lower = std::min((size_t)rank, values.size() - 1);
+    size_t upper = std::min(lower + 1, values.size() - 1);
+    return values[lower] + (values[upper] - values[lower]) * (rank - (double)lower);
+}
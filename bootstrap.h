@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <random>
+#include <vector>
+
+/*
+    Poisson bootstrap: every record of a replicate is taken Poisson(1) times, so a run of
+    k tied records is taken Poisson(k) times and sorted data never has to be resampled
+    record by record or sorted again. A record taken counts with its weight, records of a
+    weighted run are taken for records of the mean weight of the run, so intervals don't
+    depend on the scale of weights. Each replicate has its own generator seeded with
+    (seed, replicate), so results don't depend on the order replicates are computed in.
+*/
+class TPoissonSampler {
+public:
+    TPoissonSampler(uint64_t seed, size_t replicate);
+
+    size_t Sample(double mean);
+
+private:
+    double Uniform();
+
+    std::mt19937_64 Generator;
+};
+
+//Percentile of values with linear interpolation between closest ranks, sorts values
+double Percentile(std::vector<double>& values, double q);
@@ -0,0 +1,398 @@
+#!/bin/sh
+# Regression checks of OptimalThresholdFinder, run by `make check`
+BINARY=${BINARY:-./OptimalThresholdFinder}
+GENERATOR=${GENERATOR:-./ScoreGenerator}
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/otf-check-XXXXXX")
+trap 'rm -rf "$WORK"' EXIT
+FAILED=0
+
+fail() {
+    echo "FAIL: $1"
+    FAILED=1
+}
+
+#expect NAME EXPECTED COMMAND...: stdout of the command, which has to finish in 10 seconds, is EXPECTED
+expect() {
+    name=$1
+    expected=$2
+    shift 2
+    actual=$(timeout 10 "$@" 2>/dev/null)
+    [ $? -eq 0 ] || { fail "$name: exit code"; return; }
+    [ "$actual" = "$expected" ] || fail "$name: expected '$expected', got '$actual'"
+}
+
+#expect_error NAME COMMAND...: the command fails with an error rather than a timeout or success
+expect_error() {
+    name=$1
+    shift
+    #the inner shell takes the report of an abort with it
+    code=$(sh -c 'timeout 10 "$@" > /dev/null 2>&1; echo $?' sh "$@" 2> /dev/null)
+    { [ $code -ne 0 ] && [ $code -ne 124 ]; } || fail "$name: exit code $code"
+}
+
+#small curve of distinct scores shared by the checks below
+printf '1\t0.9\n0\t0.8\n1\t0.7\n1\t0.6\n0\t0.5\n0\t0.4\n1\t0.3\n0\t0.2\n0\t0.1\n' > "$WORK/curve.tsv"
+
+#metrics of every threshold of the shared curve, counted by hand; records of other classes take no part in them
+cat > "$WORK/metrics.expected" <<'END'
+0.1	0.444444	0.555556	1	0	1	0.444444	0	0.615385	0.5
+0.2	0.5	0.5	1	0.2	0.8	0.555556	1	0.666667	0.5
+0.3	0.571429	0.428571	1	0.4	0.6	0.666667	1	0.727273	0.5
+0.4	0.5	0.5	0.75	0.4	0.6	0.555556	0.666667	0.6	0.5
+0.5	0.6	0.4	0.75	0.6	0.4	0.666667	0.75	0.666667	0.5
+0.6	0.75	0.25	0.75	0.8	0.2	0.777778	0.8	0.75	0.5
+0.7	0.666667	0.333333	0.5	0.8	0.2	0.666667	0.666667	0.571429	0.5
+0.8	0.5	0.5	0.25	0.8	0.2	0.555556	0.571429	0.333333	0.5
+0.9	1	0	0.25	1	0	0.666667	0.625	0.4	0.5
+END
+awk -F '\t' '{ printf "%d\t%s\n7\t0.55\n", $1 ? 2 : 5, $2 }' "$WORK/curve.tsv" > "$WORK/classes.tsv"
+awk -F '\t' '{ printf "%d\t%s\n", $1 ? 3 : -1, $2 }' "$WORK/curve.tsv" > "$WORK/bound.tsv"
+for options in "curve.tsv" "classes.tsv -q 2 -w 5" "bound.tsv -C 0"; do
+    set -- $options
+    data=$1
+    shift
+    $BINARY -I "$WORK/$data" -A 0 -P 1 "$@" -O "$WORK/metrics.out" -F %T:%p:%d:%r:%t:%f:%a:%n:%F:%A > /dev/null 2>&1
+    cmp -s "$WORK/metrics.out" "$WORK/metrics.expected" || fail "metrics of $options"
+done
+
+#compiled output format: literals, ':' as tab, unknown fields kept as text, repeated fields and numbers as %g prints them
+printf '1\t1e-05\n0\t123456789\n1\t0.000123456789\n0\t1e20\n1\t-2.5\n0\t1.5e-300\n' > "$WORK/format.tsv"
+expect "output format" "$(printf 'T=-2.5|1\t%%z|-2.5
+T=1.5e-300|0.666667\t%%z|1.5e-300
+T=1e-05|0.666667\t%%z|1e-05
+T=0.000123457|0.333333\t%%z|0.000123457
+T=1.23457e+08|0\t%%z|1.23457e+08
+T=1e+20|0\t%%z|1e+20')" \
+    sh -c "$BINARY -I '$WORK/format.tsv' -A 0 -P 1 -O '$WORK/format.out' -F 'T=%T|%r:%z|%T' && cat '$WORK/format.out'"
+
+#mapped input file and stdin give the same curve, with a missing last newline, CRLF line ends or no lines at all
+printf '1\t0.9\n0\t0.8\r\n1\t0.7\n1\t0.6\n0\t0.5\n0\t0.4\r\n1\t0.3\n0\t0.2\n0\t0.1' > "$WORK/mapped.tsv"
+: > "$WORK/empty.tsv"
+for data in mapped empty; do
+    $BINARY -I "$WORK/$data.tsv" -A 0 -P 1 -O "$WORK/$data.file.out" -F %T:%r:%f > /dev/null 2>&1
+    $BINARY -A 0 -P 1 -O "$WORK/$data.stdin.out" -F %T:%r:%f < "$WORK/$data.tsv" > /dev/null 2>&1
+    cmp -s "$WORK/$data.file.out" "$WORK/$data.stdin.out" || fail "mapped $data input differs from stdin"
+done
+expect "mapped input" "AUC = 0.75" $BINARY -I "$WORK/mapped.tsv" -A 0 -P 1 --auc
+expect "mapped input thresholds" "9" sh -c "wc -l < '$WORK/mapped.file.out' | tr -d ' '"
+
+#input of a few MB is parsed in chunks by several threads into the curve of a single thread, line numbers
+#of errors are counted from the start of the file rather than of the chunk
+$GENERATOR --rows 300000 --seed 9 | awk 'NR == 250000 { print "1" } { print }' > "$WORK/chunks.tsv"
+for threads in 1 4; do
+    timeout 10 $BINARY -I "$WORK/chunks.tsv" -A 0 -P 1 -j $threads --auc --prauc -t fms -O "$WORK/chunks.$threads.out" -F %T:%p:%r \
+        > "$WORK/chunks.$threads.txt" 2>&1
+done
+cmp -s "$WORK/chunks.1.out" "$WORK/chunks.4.out" && cmp -s "$WORK/chunks.1.txt" "$WORK/chunks.4.txt" \
+    || fail "parsing in 4 threads differs from a single thread"
+grep -qx "$(printf "Predicted class column doesn't exist in line 250000 : 1")" "$WORK/chunks.4.txt" \
+    || fail "line number of an error of a chunk"
+
+#tied scores are a single point of the curve and count as half a pair in AUC
+printf '1\t0.5\n0\t0.5\n1\t0.7\n0\t0.7\n0\t0.2\n1\t0.2\n1\t0.7\n' > "$WORK/ties.tsv"
+expect "ties" "$(printf 'AUC = 0.583333\n0.2\t1\t1\n0.5\t0.75\t0.666667\n0.7\t0.5\t0.333333')" \
+    sh -c "$BINARY -I '$WORK/ties.tsv' -A 0 -P 1 --auc -O '$WORK/ties.out' -F %T:%r:%f && cat '$WORK/ties.out'"
+awk 'BEGIN { for (i = 0; i < 100000; ++i) printf "%d\t%g\n", i % 3 == 0, (i % 10) / 10 }' > "$WORK/ties10.tsv"
+expect "ties of many records" "$(printf 'AUC = 0.5\n10')" \
+    sh -c "$BINARY -I '$WORK/ties10.tsv' -A 0 -P 1 --auc -O '$WORK/ties10.out' -F %T && wc -l < '$WORK/ties10.out' | tr -d ' '"
+
+#--stats prints one JSON line of phases, counters and peak memory to stderr, counters count this run
+{ cat "$WORK/curve.tsv"; echo 1; } > "$WORK/stats.tsv"
+timeout 10 $BINARY -I "$WORK/stats.tsv" -A 0 -P 1 --auc --stats -O "$WORK/stats.out" 2>&1 > /dev/null | grep '^{' > "$WORK/stats.json"
+counters='"lines_read": 10, "lines_rejected": 1, "bytes_parsed": 56, "records_kept": 9, "distinct_thresholds": 9'
+expect "stats counters" "\"counters\": {$counters, \"output_bytes\": $(wc -c < "$WORK/stats.out" | tr -d ' ')}" \
+    sed 's/.*\("counters": {[^}]*}\).*/\1/' "$WORK/stats.json"
+for key in '^{"phases": {"parse": {"seconds": ' '"calls": 1}' '"output": {' '"peak_rss_kb": [1-9][0-9]*}$'; do
+    grep -q "$key" "$WORK/stats.json" || fail "stats: no $key"
+done
+expect "stats line" "1" sh -c "wc -l < '$WORK/stats.json' | tr -d ' '"
+
+#non-finite scores are rejected as invalid lines instead of breaking tied runs of the curve
+printf '1\t0.5\n0\tnan\n1\t0.7\n0\t0.2\n' > "$WORK/nan.tsv"
+expect "nan score" "AUC = 1" $BINARY -I "$WORK/nan.tsv" -A 0 -P 1 --auc
+expect "nan score, several models" "$(printf 'Column\tAUC\n1\t1\n1\t1')" $BINARY -I "$WORK/nan.tsv" -A 0 -P 1,1 --auc
+expect "nan score, bins" "AUC = 1" $BINARY -I "$WORK/nan.tsv" -A 0 -P 1 -b 10 --auc
+printf '1\t0.5\n0\t-inf\n0\t0.2\n' > "$WORK/inf.tsv"
+expect "inf score" "AUC = 1" $BINARY -I "$WORK/inf.tsv" -A 0 -P 1 --auc
+$BINARY -I "$WORK/nan.tsv" -A 0 -P 1 -W "$WORK/nan.partial" > /dev/null 2>&1
+expect "nan score, merge" "AUC = 1" $BINARY -m "$WORK/nan.partial" -m "$WORK/nan.partial" -A 0 -P 1 --auc
+
+#PR AUC interpolates precision between points as false positives grow linearly with true positives, average precision
+#is the mean precision at positives: 1, 2/3, 3/4 and 4/7 on the shared curve; both are the positive rate if all scores tie
+expect "PR AUC" "$(printf 'AUC = 0.75\nPR AUC = 0.7111\nAverage precision = 0.747024')" \
+    $BINARY -I "$WORK/curve.tsv" -A 0 -P 1 --auc --prauc --ap
+printf '1\t0.5\n0\t0.5\n1\t0.5\n0\t0.5\n0\t0.5\n' > "$WORK/tied.tsv"
+expect "PR AUC of ties" "$(printf 'PR AUC = 0.4\nAverage precision = 0.4')" $BINARY -I "$WORK/tied.tsv" -A 0 -P 1 --prauc --ap
+printf '1\t0.9\n1\t0.8\n0\t0.5\n0\t0.1\n' > "$WORK/separated.tsv"
+expect "PR AUC of separated classes" "$(printf 'PR AUC = 1\nAverage precision = 1')" \
+    $BINARY -I "$WORK/separated.tsv" -A 0 -P 1 --prauc --ap
+
+#alpha sweep agrees with -t fms -a at the grid end points, including ties of recall at alpha = 0
+printf '0\t0.004\n0\t0.07\n1\t0.5\n0\t0.3\n1\t0.9\n' > "$WORK/tie.tsv"
+for data in tie curve; do
+    sweep=$(timeout 10 $BINARY -I "$WORK/$data.tsv" -A 0 -P 1 -s 4 2>/dev/null)
+    for alpha in 0 1; do
+        threshold=$(timeout 10 $BINARY -I "$WORK/$data.tsv" -A 0 -P 1 -t fms -a $alpha 2>/dev/null \
+                    | sed -n 's/^Optimal threshold = \([^\t]*\)\t.*/\1/p')
+        row=$(echo "$sweep" | awk -F '\t' -v alpha=$alpha '$1 == alpha { print $2 }')
+        [ -n "$threshold" ] && [ "$row" = "$threshold" ] \
+            || fail "sweep of $data at alpha $alpha: expected '$threshold', got '$row'"
+    done
+done
+
+#queries are answered in one scan with the same results as separate runs, unsatisfiable ones print "-"
+printf 'prc tpr 0.7\nfms - - 0.2\nacc\ntpr prc 2\n' > "$WORK/queries.txt"
+expect "queries" "$(printf 'Target\tArgument\tArgval\tAlpha\tOptimal threshold\tTarget function\tArgument
+prc\ttpr\t0.7\t0.5\t0.6\t0.75\t0.75
+fms\t-\t-\t0.2\t0.3\t0.869565\t-
+acc\t-\t-\t0.5\t0.6\t0.777778\t-
+tpr\tprc\t2\t0.5\t-\t-\t-')" $BINARY -I "$WORK/curve.tsv" -A 0 -P 1 -Q "$WORK/queries.txt"
+expect "single query" "$(printf 'Optimal threshold = 0.3\tTarget function = 0.869565')" \
+    $BINARY -I "$WORK/curve.tsv" -A 0 -P 1 -t fms -a 0.2
+
+#frontier segments and the grid of the sweep on the shared curve
+expect "frontier" "$(printf 'Alpha from\tAlpha to\tOptimal threshold\tPrecision\tRecall
+0\t0\t0.1\t0.444444\t1
+0\t0.444444\t0.3\t0.571429\t1
+0.444444\t0.888889\t0.6\t0.75\t0.75
+0.888889\t1\t0.9\t1\t0.25
+Alpha\tOptimal threshold\tF-measure\tPrecision\tRecall
+0\t0.1\t1\t0.444444\t1
+0.5\t0.6\t0.75\t0.75\t0.75
+1\t0.9\t1\t1\t0.25')" $BINARY -I "$WORK/curve.tsv" -A 0 -P 1 --frontier -s 2
+
+#histogram of two bins of the shared curve, counted by hand: scores of a bin are ties, which bounds the AUC error,
+#thresholds are lower bin edges and scores out of range go to the edge bins
+for range in 0:1 0.3:0.7; do
+    expect "histogram $range" "$(printf 'AUC = 0.675\nAUC error bound = 0.225\nOptimal threshold = 0.5\tTarget function = 0.666667')" \
+        $BINARY -I "$WORK/curve.tsv" -A 0 -P 1 -b 2 -r $range --auc -t fms
+done
+expect "histogram out of range" "4 scores are out of histogram range, they are counted in the edge bins." \
+    sh -c "$BINARY -I '$WORK/curve.tsv' -A 0 -P 1 -b 2 -r 0.3:0.7 --auc 2>&1 > /dev/null"
+
+#decimated plot keeps curve order, so non-monotone precision isn't reordered, collinear points are dropped
+expect "decimated plot of precision" "$(printf '0.444444\t1\n0.571429\t1\n0.5\t0.75\n0.75\t0.75\n0.666667\t0.5\n0.5\t0.25\n1\t0.25')" \
+    sh -c "$BINARY -I '$WORK/curve.tsv' -A 0 -P 1 -p '$WORK/prc.plot' -x prc -y tpr -D 0.001 > /dev/null && cat '$WORK/prc.plot'"
+expect "decimated ROC" "$(printf '0\t0.25\n0.2\t0.25\n0.2\t0.75\n0.6\t0.75\n0.6\t1\n1\t1')" \
+    sh -c "$BINARY -I '$WORK/curve.tsv' -A 0 -P 1 -p '$WORK/roc.plot' -x fpr -y tpr -D 0.001 > /dev/null && cat '$WORK/roc.plot'"
+
+#radix sort of big columns gives the curve std::sort gives to shards small enough for it, merged from partials,
+#for scores of both signs and of magnitudes far apart
+awk 'BEGIN { for (i = 0; i < 30000; ++i) { r = (i * 7919) % 20011 - 10000
+                                         printf "%d\t%.17g\n", (i * 13) % 7 < 3, r / 7 * ((i % 3) ? 1e100 : 1e-200) } }' \
+    > "$WORK/radix.tsv"
+split -l 3000 "$WORK/radix.tsv" "$WORK/radix.shard."
+merge=""
+for shard in "$WORK"/radix.shard.*; do
+    $BINARY -I "$shard" -A 0 -P 1 -W "$shard.partial" > /dev/null 2>&1
+    merge="$merge -m $shard.partial"
+done
+$BINARY $merge -A 0 -P 1 -O "$WORK/radix.merged.out" -F %T:%r:%f > /dev/null 2>&1
+$BINARY -I "$WORK/radix.tsv" -A 0 -P 1 -j 4 -O "$WORK/radix.out" -F %T:%r:%f > /dev/null 2>&1
+cmp -s "$WORK/radix.out" "$WORK/radix.merged.out" || fail "radix sort differs from std::sort"
+expect "radix sort thresholds" "$(cut -f 2 "$WORK/radix.tsv" | sort -g -u | wc -l | tr -d ' ')" \
+    sh -c "wc -l < '$WORK/radix.out' | tr -d ' '"
+
+#-0 is printed as 0 whether the column goes to std::sort or to the radix sort
+printf '1\t-0\n0\t-0.5\n1\t0.5\n' > "$WORK/zero.tsv"
+awk 'BEGIN { for (i = 0; i < 20000; ++i) printf "%d\t%s\n", i % 2, (i % 5) ? i / 20000 : "-0" }' > "$WORK/zeros.tsv"
+for data in zero zeros; do
+    $BINARY -I "$WORK/$data.tsv" -A 0 -P 1 -O "$WORK/$data.out" -F %T > /dev/null 2>&1
+    grep -qx -- '-0' "$WORK/$data.out" && fail "negative zero threshold of $data"
+    grep -qx '0' "$WORK/$data.out" || fail "zero threshold of $data"
+done
+
+#groups of the key column are evaluated as files of their own records, after the results of all records
+awk -F '\t' '{ printf "%s\t%s\t%s\n", $1, $2, (NR % 2) ? "a" : "b" }' "$WORK/curve.tsv" > "$WORK/groups.tsv"
+expect "groups" "$(printf 'AUC = 0.75\nOptimal threshold = 0.6\tTarget function = 0.75\n
+Group\tAUC\tOptimal threshold\tTarget function\na\t0.833333\t0.3\t0.857143\nb\t0.666667\t0.6\t0.666667')" \
+    $BINARY -I "$WORK/groups.tsv" -A 0 -P 1 -g 2 --auc -t fms -j 4
+for group in a b; do
+    expect "group $group" "$(timeout 10 $BINARY -I "$WORK/groups.tsv" -A 0 -P 1 -g 2 --auc -t fms 2>/dev/null \
+                             | awk -F '\t' -v group=$group '$1 == group { print "AUC = " $2 "\nOptimal threshold = " $3 "\tTarget function = " $4 }')" \
+        sh -c "grep '	$group\$' '$WORK/groups.tsv' | $BINARY -A 0 -P 1 --auc -t fms"
+done
+
+#several models are evaluated in parallel, a model without a threshold satisfying the argument gets "-"
+printf '1\t0.9\t0.1\n0\t0.8\t0.2\n1\t0.7\t0.3\n0\t0.5\t0.9\n' > "$WORK/models.tsv"
+expect "several models" "$(printf 'Column\tAUC\tOptimal threshold\tTarget function\tArgument
+1\t0.75\t0.9\t0.5\t1
+2\t0.25\t-\t-\t-')" $BINARY -I "$WORK/models.tsv" -A 0 -P 1,2 -t tpr -Y prc -M 0.9 -j 4
+$BINARY -I "$WORK/models.tsv" -A 0 -P 1 -W "$WORK/models.partial" > /dev/null 2>&1
+expect_error "several models of partial files" $BINARY -m "$WORK/models.partial" -A 0 -P 1,2 --auc
+
+#cache is read instead of the input until the input or reading parameters change, lines_read of --stats tells which
+cp "$WORK/curve.tsv" "$WORK/cached.tsv"
+#command of the cached runs, sed leaves the number of read lines of --stats
+cached="$BINARY -I '$WORK/cached.tsv' -A 0 -P 1 -K '$WORK/cached.cache' --auc --stats"
+lines_read='s/^{.*"lines_read": \([0-9]*\).*/lines read \1/'
+expect "cache written" "$(printf 'AUC = 0.75\nlines read 9')" \
+    sh -c "$cached 2>&1 | sed '$lines_read'"
+expect "cache read" "$(printf 'AUC = 0.75\nlines read 0')" \
+    sh -c "$cached 2>&1 | sed '$lines_read'"
+printf '1\t0.05\n' >> "$WORK/cached.tsv"
+expect "cache of a changed input" "$(printf 'AUC = 0.6\nlines read 10')" \
+    sh -c "$cached 2>&1 | sed '$lines_read'"
+expect "cache of other bins" "$(printf 'AUC = 0.6\nAUC error bound = 0.24\nlines read 10')" \
+    sh -c "$cached -b 2 2>&1 | sed '$lines_read'"
+expect "cache of bins read" "$(printf 'AUC = 0.6\nAUC error bound = 0.24\nlines read 0')" \
+    sh -c "$cached -b 2 2>&1 | sed '$lines_read'"
+
+#one-vs-rest: a class is the binary run of its column with other classes negative, macro is the mean of classes
+#and micro is the binary run of records of all classes pooled
+awk 'BEGIN { for (i = 0; i < 30; ++i) { c = (i * 7) % 3
+                                      printf "%d\t%.2f\t%.2f\t%.2f\n", c, (i * 37) % 100 / 100 + (c == 0) * 0.3,
+                                          (i * 53) % 100 / 100 + (c == 1) * 0.3, (i * 71) % 100 / 100 + (c == 2) * 0.3 } }' \
+    > "$WORK/classes3.tsv"
+expect "one-vs-rest" "$(printf 'Class\tAUC\tPR AUC\tOptimal threshold\tTarget function
+0\t0.7575\t0.685269\t0.41\t0.6
+1\t0.8075\t0.73717\t0.37\t0.645161
+2\t0.77\t0.666273\t0.37\t0.625
+Macro\t0.778333\t0.696238\t-\t0.623387
+Micro\t0.774444\t0.689051\t0.37\t0.610526')" $BINARY -I "$WORK/classes3.tsv" -A 0 -P 1,2,3 -c 0,1,2 --auc --prauc -t fms -j 4
+for class in 0 1 2; do
+    awk -F '\t' -v class=$class '{ print ($1 == class) "\t" $(class + 2) }' "$WORK/classes3.tsv" > "$WORK/class$class.tsv"
+done
+cat "$WORK/class0.tsv" "$WORK/class1.tsv" "$WORK/class2.tsv" > "$WORK/pooled.tsv"
+for data in class0 class1 class2 pooled; do
+    timeout 10 $BINARY -I "$WORK/$data.tsv" -A 0 -P 1 --auc --prauc -t fms 2>/dev/null
+done | sed -n 's/^AUC = //p; s/^PR AUC = //p; s/^Optimal threshold = \(.*\)\tTarget function = /\1\t/p' | paste - - - \
+    > "$WORK/binary.txt"
+timeout 10 $BINARY -I "$WORK/classes3.tsv" -A 0 -P 1,2,3 -c 0,1,2 --auc --prauc -t fms 2>/dev/null \
+    | awk -F '\t' '$1 != "Class" && $1 != "Macro" { print $2 "\t" $3 "\t" $4 "\t" $5 }' | cmp -s - "$WORK/binary.txt" \
+    || fail "one-vs-rest differs from binary runs"
+
+#spilled runs are merged into the same results as the ones of reading in memory
+$GENERATOR --rows 5000 --positive-rate 0.3 --distinct 1000 --seed 5 > "$WORK/spill.tsv"
+for options in "--auc --prauc --ap -t fms" "-b 50 --auc -t acc"; do
+    expect "spill $options" "$(timeout 10 $BINARY -I "$WORK/spill.tsv" -A 0 -P 1 $options 2>/dev/null)" \
+        $BINARY -I "$WORK/spill.tsv" -A 0 -P 1 -E 0.01 $options
+done
+expect "spill of several models" "$(timeout 10 $BINARY -I "$WORK/spill.tsv" -A 0 -P 1,1 --auc 2>/dev/null)" \
+    $BINARY -I "$WORK/spill.tsv" -A 0 -P 1,1 -E 0.01 --auc
+
+#partials of shards merge into the results of the whole file, partials of different histograms are rejected
+head -2500 "$WORK/spill.tsv" > "$WORK/shard1.tsv"
+tail -n +2501 "$WORK/spill.tsv" > "$WORK/shard2.tsv"
+for bins in 0 50 60; do
+    for shard in 1 2; do
+        $BINARY -I "$WORK/shard$shard.tsv" -A 0 -P 1 -b $bins -W "$WORK/shard$shard.$bins.partial" > /dev/null 2>&1
+    done
+done
+for bins in 0 50; do
+    expect "partial merge, $bins bins" "$(timeout 10 $BINARY -I "$WORK/spill.tsv" -A 0 -P 1 -b $bins --auc --prauc -t fms 2>/dev/null)" \
+        $BINARY -m "$WORK/shard1.$bins.partial" -m "$WORK/shard2.$bins.partial" -A 0 -P 1 --auc --prauc -t fms
+done
+expect_error "partial merge of different bins" $BINARY -m "$WORK/shard1.50.partial" -m "$WORK/shard2.60.partial" -A 0 -P 1 --auc
+expect_error "partial merge of binned and exact" $BINARY -m "$WORK/shard1.0.partial" -m "$WORK/shard2.50.partial" -A 0 -P 1 --auc
+
+#bootstrap replicates don't depend on threads count, intervals contain the point estimate and narrow with confidence
+bootstrap="$BINARY -I $WORK/spill.tsv -A 0 -P 1 -B 300 -S 3 --auc -t tpr -Y prc -M 0.9"
+expect "bootstrap threads" "$(timeout 10 $bootstrap -j 1 2>/dev/null)" $bootstrap -j 4
+{ timeout 10 $bootstrap 2>/dev/null; timeout 10 $bootstrap -L 0.5 2>/dev/null; } | awk -F '[][;= \t]+' '
+    /^AUC = / { auc = $2 }
+    /^AUC interval/ { lower[++n] = $3; upper[n] = $4 }
+    END { exit !(n == 2 && lower[1] < auc && auc < upper[1] && lower[1] < lower[2] && upper[2] < upper[1]) }' \
+    || fail "bootstrap intervals"
+
+#a record of weight k counts as k records of weight 1, records of zero weight are skipped
+awk -F '\t' '{ printf "%s\t%s\t%d\n0\t0.45\t0\n", $1, $2, NR % 3 + 1 }' "$WORK/curve.tsv" > "$WORK/weighted.tsv"
+awk -F '\t' '{ for (i = 0; i < NR % 3 + 1; ++i) print }' "$WORK/curve.tsv" > "$WORK/repeated.tsv"
+expect "weights" "$(timeout 10 $BINARY -I "$WORK/repeated.tsv" -A 0 -P 1 --auc --prauc -t fms 2>/dev/null)" \
+    $BINARY -I "$WORK/weighted.tsv" -A 0 -P 1 -G 2 --auc --prauc -t fms
+
+#bootstrap intervals of weighted records don't depend on the scale of weights
+awk 'BEGIN { for (i = 0; i < 300; ++i) printf "%d\t%g\t%d\n", (i * 7) % 5 < 2, (i * 13) % 50 / 50 + ((i * 7) % 5 < 2) * 0.3, 1 + i % 4 }' \
+    > "$WORK/weights.tsv"
+awk -F '\t' '{ printf "%s\t%s\t%d\n", $1, $2, $3 * 1000 }' "$WORK/weights.tsv" > "$WORK/weights1000.tsv"
+bootstrap=$(timeout 10 $BINARY -I "$WORK/weights.tsv" -A 0 -P 1 -G 2 -B 200 -S 7 -t fms 2>/dev/null)
+echo "$bootstrap" | grep -q '^AUC interval = \[' || fail "weighted bootstrap: no interval"
+expect "weighted bootstrap, scaled weights" "$bootstrap" $BINARY -I "$WORK/weights1000.tsv" -A 0 -P 1 -G 2 -B 200 -S 7 -t fms
+expect_error "weighted bootstrap of bins" $BINARY -I "$WORK/weights.tsv" -A 0 -P 1 -G 2 -B 200 -b 10
+
+#server round trip through the bundled client, idle clients don't hold threads and STOP doesn't wait for them
+SOCKET="$WORK/server.sock"
+timeout 20 $BINARY -X "$SOCKET" -j 2 2>/dev/null &
+server=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$SOCKET" ] && break
+    sleep 0.2
+done
+#idle clients are connected and wait for their request body from a pipe until it is closed
+mkfifo "$WORK/idle"
+exec 3<>"$WORK/idle"
+idle=""
+for i in 1 2 3; do
+    $BINARY -Z "$SOCKET" INGEST idle < "$WORK/idle" > /dev/null 2>&1 3>&- &
+    idle="$idle $!"
+done
+sleep 0.2
+expect "server open" "" $BINARY -Z "$SOCKET" OPEN curve 0 1
+expect "server ingest" "$(printf 'Rejected lines\t1')" \
+    sh -c "{ cat '$WORK/curve.tsv'; echo 1; } | $BINARY -Z '$SOCKET' INGEST curve"
+expect "server AUC" "$(printf 'AUC\t0.75\nPR AUC\t0.7111\nAverage precision\t0.747024')" $BINARY -Z "$SOCKET" AUC curve
+expect "server query" "$(printf '0.6\t0.75\t-')" sh -c "echo fms | $BINARY -Z '$SOCKET' QUERY curve"
+#binned data set is updated online: retracted rows restore the results the CLI gives for the same bins, metrics
+#at a threshold are the ones of the output file and rows which haven't been ingested can't be retracted
+curve_auc="$(printf 'AUC\t0.75\nPR AUC\t0.7111\nAverage precision\t0.747024')"
+expect "online open" "" $BINARY -Z "$SOCKET" OPEN binned 0 1 bins=10
+expect "online ingest" "$(printf 'Rejected lines\t0')" sh -c "$BINARY -Z '$SOCKET' INGEST binned < '$WORK/curve.tsv'"
+expect "online AUC" "$curve_auc" $BINARY -Z "$SOCKET" AUC binned
+printf '1\t0.15\n0\t0.95\n' > "$WORK/window.tsv"
+expect "online ingest window" "$(printf 'Rejected lines\t0')" sh -c "$BINARY -Z '$SOCKET' INGEST binned < '$WORK/window.tsv'"
+expect "online AUC of window" "$(printf 'AUC\t0.533333\nPR AUC\t0.478811\nAverage precision\t0.510909\nAUC error bound\t0.0333333')" \
+    $BINARY -Z "$SOCKET" AUC binned
+expect "online retract window" "$(printf 'Rejected lines\t0')" sh -c "$BINARY -Z '$SOCKET' RETRACT binned < '$WORK/window.tsv'"
+expect "online AUC after retraction" "$curve_auc" $BINARY -Z "$SOCKET" AUC binned
+expect "online metrics" "$(grep '^0.5	' "$WORK/metrics.expected" | cut -f 1,2,4)" $BINARY -Z "$SOCKET" METRICS binned 0.5 %T:%p:%r
+expect_error "online retract of missing rows" sh -c "printf '0\t0.95\n0\t0.95\n' | $BINARY -Z '$SOCKET' RETRACT binned"
+expect "online AUC after failed retraction" "$curve_auc" $BINARY -Z "$SOCKET" AUC binned
+expect "server stop" "" $BINARY -Z "$SOCKET" STOP
+wait $server || fail "server didn't stop"
+exec 3>&-
+wait $idle
+
+#metrics of the vectorized kernel, computed in blocks for the output file, equal the ones of TOpCounter, which
+#the sampled plot computes point by point, for every metric over more points than a block
+$GENERATOR --rows 3000 --seed 11 --distinct 700 > "$WORK/kernel.tsv"
+for metric in prc:%p tpr:%r fms:%F npv:%n acc:%a tnr:%t fdr:%d fpr:%f; do
+    $BINARY -I "$WORK/kernel.tsv" -A 0 -P 1 -a 0.3 -O "$WORK/kernel.out" -F "%T:${metric#*:}" \
+        -p "$WORK/kernel.plot" -x thr -y ${metric%%:*} -n 100000 > /dev/null 2>&1
+    sort -u "$WORK/kernel.plot" | sort -g | cmp -s - "$WORK/kernel.out" || fail "kernel ${metric%%:*}"
+done
+
+#generated data is the same for a seed and has the requested number of rows
+$GENERATOR --rows 1000 --positive-rate 0.3 --distinct 100 --seed 3 > "$WORK/generated.tsv"
+$GENERATOR --rows 1000 --positive-rate 0.3 --distinct 100 --seed 3 | cmp -s - "$WORK/generated.tsv" \
+    || fail "generator isn't deterministic"
+expect "generator rows" "1000" sh -c "wc -l < '$WORK/generated.tsv' | tr -d ' '"
+
+#naive Bayes scores match nbc.py: check_nbc_*.tsv are nbc.py outputs of name, label, score and fold
+#for the folds of -k 5 -S 1 over the first 120 learn names and for 40 test names, nbc.py prints 12 digits
+#compare_scores NAME EXPECTED ACTUAL: names, labels and folds are equal, scores differ by rounding only
+compare_scores() {
+    [ -s "$3" ] && [ $(wc -l < "$2") -eq $(wc -l < "$3") ] || { fail "$1: rows"; return; }
+    paste "$2" "$3" | awk -F '\t' '
+        {
+            columns = NF / 2
+            for (i = 1; i <= columns; ++i) {
+                difference = (i == 3) ? $i - $(columns + i) : 0
+                if ((i == 3) ? (difference > 1e-11 * $i || -difference > 1e-11 * $i) : ($i != $(columns + i)))
+                    bad = 1
+            }
+        }
+        END { exit bad }' || fail "$1: scores differ from nbc.py"
+}
+head -120 names_learn_pool.txt > "$WORK/nbc_samples.txt"
+head -40 names_test_pool.txt > "$WORK/nbc_test.txt"
+$BINARY -N complex -k 5 -S 1 -I "$WORK/nbc_samples.txt" -U "$WORK/nbc_folds.tsv" > /dev/null 2>&1
+compare_scores "naive Bayes folds" check_nbc_folds.tsv "$WORK/nbc_folds.tsv"
+$BINARY -N simple -R names_learn_pool.txt -I "$WORK/nbc_test.txt" -U "$WORK/nbc_train.tsv" > /dev/null 2>&1
+compare_scores "naive Bayes train" check_nbc_train.tsv "$WORK/nbc_train.tsv"
+#an empty fold and a fold without a satisfying threshold print "-" instead of terminating
+$BINARY -N simple -k 200 -I "$WORK/nbc_samples.txt" -t tpr -Y prc -M 0.999 -j 4 > "$WORK/nbc_empty.txt" 2>/dev/null \
+    || fail "naive Bayes empty folds"
+grep -q '^Pooled' "$WORK/nbc_empty.txt" || fail "naive Bayes empty folds: no pooled row"
+
+[ $FAILED -eq 0 ] && echo "All checks passed"
+exit $FAILED
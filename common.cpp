@@ -1,5 +1,9 @@
 #include "common.h"
 
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
 std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems) {
     std::stringstream ss(s);
     std::string item;
@@ -15,4 +19,163 @@ std::vector<std::string> split(const std::string &s, char delim) {
     std::vector<std::string> elems;
     split(s, delim, elems);
     return elems;
-}
\ No newline at end of file
+}
+
+size_t SplitFields(const char* begin, const char* end, char delim, TFieldRange* fields, size_t maxFields) {
+    size_t count = 0;
+    while ((begin != end) && (count < maxFields)) {
+        const char* fieldEnd = (const char*)memchr(begin, delim, end - begin);
+        if (!fieldEnd)
+            fieldEnd = end;
+        if (fieldEnd != begin) {
+            fields[count].Begin = begin;
+            fields[count].End = fieldEnd;
+            ++count;
+        }
+        begin = (fieldEnd == end) ? end : fieldEnd + 1;
+    }
+    return count;
+}
+
+static inline bool IsSpace(char c) {
+    return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+static inline bool IsDigit(char c) {
+    return (c >= '0') && (c <= '9');
+}
+
+//Handles everything the fast path can't: long mantissas, huge exponents, inf, nan, hex
+static const char* ParseDoubleSlow(const char* begin, const char* end, double& value) {
+    char buffer[128];
+    size_t length = end - begin;
+    std::string longField;
+    const char* str;
+    if (length < sizeof(buffer)) {
+        memcpy(buffer, begin, length);
+        buffer[length] = 0;
+        str = buffer;
+    } else {
+        longField.assign(begin, end);
+        str = longField.c_str();
+    }
+    char* parsed;
+    value = strtod(str, &parsed);
+    return begin + (parsed - str);
+}
+
+const char* ParseDouble(const char* begin, const char* end, double& value) {
+    //exactly representable powers of 10, see Clinger's fast path
+    static const double POWERS[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    static const uint64_t MAX_EXACT_MANTISSA = (uint64_t)1 << 53;
+
+    while ((begin != end) && IsSpace(*begin))
+        ++begin;
+    const char* p = begin;
+    bool negative = false;
+    if ((p != end) && ((*p == '-') || (*p == '+'))) {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool hasDigits = false;
+    while ((p != end) && (*p == '0')) {
+        hasDigits = true;
+        ++p;
+    }
+    while ((p != end) && IsDigit(*p)) {
+        if (digits < 19)
+            mantissa = mantissa * 10 + (*p - '0');
+        else
+            ++exponent;
+        ++digits;
+        hasDigits = true;
+        ++p;
+    }
+    if ((p != end) && (*p == '.')) {
+        ++p;
+        if (!digits) {
+            while ((p != end) && (*p == '0')) {
+                --exponent;
+                hasDigits = true;
+                ++p;
+            }
+        }
+        while ((p != end) && IsDigit(*p)) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                --exponent;
+            }
+            ++digits;
+            hasDigits = true;
+            ++p;
+        }
+    }
+    if (!hasDigits) {
+        if ((p != end) && ((*p | 0x20) == 'i' || (*p | 0x20) == 'n'))
+            return ParseDoubleSlow(begin, end, value);
+        value = 0;
+        return begin;
+    }
+    if ((p != end) && ((*p | 0x20) == 'x'))
+        return ParseDoubleSlow(begin, end, value);
+    if ((p != end) && ((*p | 0x20) == 'e')) {
+        const char* e = p + 1;
+        bool negativeExponent = false;
+        if ((e != end) && ((*e == '-') || (*e == '+'))) {
+            negativeExponent = (*e == '-');
+            ++e;
+        }
+        if ((e != end) && IsDigit(*e)) {
+            int explicitExponent = 0;
+            while ((e != end) && IsDigit(*e)) {
+                if (explicitExponent < 100000)
+                    explicitExponent = explicitExponent * 10 + (*e - '0');
+                ++e;
+            }
+            exponent += negativeExponent ? -explicitExponent : explicitExponent;
+            p = e;
+        }
+    }
+
+    if ((digits > 19) || (mantissa > MAX_EXACT_MANTISSA) || (exponent < -22) || (exponent > 22))
+        return ParseDoubleSlow(begin, end, value);
+
+    value = (double)mantissa;
+    if (exponent < 0)
+        value /= POWERS[-exponent];
+    else
+        value *= POWERS[exponent];
+    if (negative)
+        value = -value;
+    return p;
+}
+
+const char* ParseInt(const char* begin, const char* end, int& value) {
+    while ((begin != end) && IsSpace(*begin))
+        ++begin;
+    const char* p = begin;
+    bool negative = false;
+    if ((p != end) && ((*p == '-') || (*p == '+'))) {
+        negative = (*p == '-');
+        ++p;
+    }
+    if ((p == end) || !IsDigit(*p)) {
+        value = 0;
+        return begin;
+    }
+    long long result = 0;
+    while ((p != end) && IsDigit(*p)) {
+        if (result <= 0xFFFFFFFFLL)
+            result = result * 10 + (*p - '0');
+        ++p;
+    }
+    value = (int)(negative ? -result : result);
+    return p;
+}
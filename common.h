@@ -5,4 +5,22 @@
 #include <vector>
 
 std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems);
-std::vector<std::string> split(const std::string &s, char delim);
\ No newline at end of file
+std::vector<std::string> split(const std::string &s, char delim);
+
+struct TFieldRange {
+    const char* Begin;
+    const char* End;
+};
+
+//Non-allocating version of split() for [begin; end) range. Empty fields are skipped
+//the same way, only the first maxFields fields are stored. Returns number of stored fields.
+size_t SplitFields(const char* begin, const char* end, char delim, TFieldRange* fields, size_t maxFields);
+
+/*
+    Non-allocating counterparts of atof/atoi working on [begin; end) ranges which
+    are not required to be zero terminated. Leading whitespace is skipped, the longest
+    numeric prefix is parsed and 0 is stored if there is none, just like atof/atoi do.
+    Return pointer to the first character after the parsed number.
+*/
+const char* ParseDouble(const char* begin, const char* end, double& value);
+const char* ParseInt(const char* begin, const char* end, int& value);
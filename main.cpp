@@ -1,5 +1,11 @@
 #include "opfinder.h"
+#include "common.h"
+#include "threadpool.h"
+#include "server.h"
+#include "stats.h"
+#include "naivebayes.h"
 
+#include <math.h>
 #include <iostream>
 #include <string>
 #include <algorithm>
@@ -9,7 +15,24 @@ void print_usage() {
     std::cout << "Usage:\n"
               << "\t-I, --inputfile\n\t\tTab separated file. If not specified data will be read from stdin. To finish input in stdin input empty line.\n"
               << "\t-A, --actualcol\n\t\tNumber of column in tab separated input file, where actual class is stored. Starting from 0.\n"
-              << "\t-P, --predictedcol\n\t\tNumber of column in tab separated input file, where predicted class is stored. Starting from 0."
+              << "\t-P, --predictedcol\n\t\tNumber of column in tab separated input file, where predicted class is stored. Starting from 0.\n"
+              << "\t\tSeveral comma separated columns can be given to evaluate a number of models in one pass. Results are printed\n"
+              << "\t\tas a table, output, plot and partial files get column number as a suffix.\n"
+              << "\t-G, --weightcol\n\t\tNumber of column with record weights. Counts of records in all metrics are replaced with sums\n"
+              << "\t\tof their weights. Weights should be non-negative, records of zero weight are skipped.\n"
+              << "\t-g, --groupcol\n\t\tNumber of column with group keys, e.g. country or traffic source. Input is read once,\n"
+              << "\t\trecords are split by key and every group is evaluated separately. Results of groups are printed\n"
+              << "\t\tas a table after the results of the whole data set, queries are answered for every group as well.\n"
+              << "\t-c, --classes\n\t\tOne-vs-rest mode: comma separated class ids, each of them is positive in turn and all other\n"
+              << "\t\tclasses are negative. --predictedcol should list score columns of the classes in the same order.\n"
+              << "\t\tThe file is parsed once, classes are evaluated in parallel and printed as a table with macro\n"
+              << "\t\t(mean over classes) and micro (records of all classes pooled) averages.\n"
+              << "\t--auc\n\t\tPrint area under ROC curve.\n"
+              << "\t--prauc\n\t\tPrint area under precision-recall curve. Precision is interpolated between thresholds\n"
+              << "\t\tas false positives grow linearly with true positives, not linearly itself.\n"
+              << "\t--ap\n\t\tPrint average precision: sum of precisions at thresholds weighted by recall increments.\n"
+              << "\t--stats\n\t\tPrint time of processing phases, counters of lines, records, thresholds and output bytes\n"
+              << "\t\tand peak memory to stderr as JSON when finished.\n"
               << "\t-O, --outputfile\n\t\tFile to store calculated results\n"
               << "\t-F, --formatstring\n\t\tFormat string to specify output format. No whitespaces are allowed. \\t - :\n"
               << "\t\t%T - Threshold\n"
@@ -23,6 +46,9 @@ void print_usage() {
               << "\t\t%F - F-measure\n"
               << "\t\t%A - Alpha\n"
               << "\t-n, --points\n\t\tNumber of points to build plot\n"
+              << "\t-D, --deviation\n\t\tDecimate the plot instead of sampling --points: curve points are kept so that no other point is\n"
+              << "\t\tfarther than the given distance from the line through them (Ramer-Douglas-Peucker, which doesn't\n"
+              << "\t\tkeep the fewest such points). Points are written in curve order, so the line is the plotted one.\n"
               << "\t-p, --plot\n\t\tSpecifies file to output values for plot. If option is not specified, plot is not going to be calculated.\n"
               << "\t-x, --xaxis\n\t\tSpecifies a value to be calculated as an X-axis in the plot.\n"
               << "\t-y, --yaxis\n\t\tSpecifies a value to be calculated as an Y-axis in the plot. Possible values for X and Y axis::\n"
@@ -47,15 +73,145 @@ void print_usage() {
               << "\t\tfpr - False Positive Rate\n"
               << "\t\tacc - Accuracy\n"
               << "\t-Y, --argument\n\t\tArgument for target function. Possible values are the same as for target function\n"
+              << "\t-Q, --queries\n\t\tFile with optimal threshold queries answered in one pass, one per line:\n"
+              << "\t\tTARGET [ARGUMENT ARGVAL [ALPHA]], \"-\" skips a field. Results are printed as a table,\n"
+              << "\t\t\"-\" is printed if no threshold satisfies the argument value.\n"
               << "\t-M, --argval\n\t\tSpecifies min arg value for target function. Should be in [0;1].\n"
+              << "\t-s, --sweep\n\t\tNumber of steps of alpha grid over [0;1]: the optimal threshold of F-measure, its value, precision\n"
+              << "\t\tand recall are printed as a table for every alpha of the grid. All alphas are answered from one\n"
+              << "\t\tpass over the curve, which finds the optimal thresholds of all alphas at once.\n"
+              << "\t--frontier\n\t\tPrint the whole alpha to optimal threshold frontier: ranges of alpha sharing an optimal threshold\n"
+              << "\t\tof F-measure.\n"
               << "\t-q, --pc\n\t\tSpecified value is treated as positive class. Classes that are nor positive nor negative will be ignored.\n"
               << "\t-w, --nc\n\t\tSpecified value is treated as negative class. Classes that are nor positive nor negative will be ignored.\n"
               << "\t-C, --C\n\t\tSpecified value is treated as a boundary value in a set of positive and negative classes.\n"
               << "\t\tThis option overrides --pc and --nc options\n"
               << "\t\tClass > VALUE => Positive Class\n"
-              << "\t\tClass <= VALUE => Negative Class\n";
+              << "\t\tClass <= VALUE => Negative Class\n"
+              << "\t-j, --threads\n\t\tNumber of threads to parse input file with. 0 means all available cores.\n"
+              << "\t\tData from stdin is always parsed in a single thread.\n"
+              << "\t-b, --bins\n\t\tStreaming mode: scores are counted in specified number of equal bins instead of being stored and sorted.\n"
+              << "\t\tMemory doesn't depend on input size. Thresholds are limited to bin edges, so the optimal threshold\n"
+              << "\t\tis found up to a bin width. Metrics are exact for reported thresholds. Scores in a bin are treated as ties,\n"
+              << "\t\twhich moves AUC by at most the printed error bound.\n"
+              << "\t-r, --range\n\t\tScore range covered by bins in MIN:MAX format. Scores outside of it are counted in the edge bins.\n"
+              << "\t-W, --partial\n\t\tFile to store partial results of this shard: distinct thresholds with class counts in binary format.\n"
+              << "\t-m, --merge\n\t\tPartial results file to merge instead of reading input. Can be repeated, all other options\n"
+              << "\t\tare applied to the merged results as if all shards were read at once.\n"
+              << "\t-B, --bootstrap\n\t\tNumber of bootstrap replicates to build percentile intervals of AUC and, if target function is set,\n"
+              << "\t\tof optimal threshold and target function. Records are resampled with Poisson weights, weighted records\n"
+              << "\t\tcan't be resampled with bins, merge, cache or memory limit.\n"
+              << "\t-L, --confidence\n\t\tConfidence level of bootstrap intervals in (0;1).\n"
+              << "\t-S, --seed\n\t\tRandom seed of bootstrap and of cross validation folds, results don't depend on threads count.\n"
+              << "\t-K, --cache\n\t\tCache file for parsed and sorted input file. It is used instead of the input file if neither\n"
+              << "\t\tthe file nor columns, classes and bins have been changed since the cache was written, otherwise\n"
+              << "\t\tthe input file is read and the cache is rewritten. Several models get column number as a suffix.\n"
+              << "\t-E, --memory\n\t\tMemory limit in megabytes for external sorting. Parsed records exceeding it are sorted and spilled\n"
+              << "\t\tto temporary files, which are merged into the curve after reading. Results are the same as in memory.\n"
+              << "\t\tThe merged curve isn't bounded by the limit: it takes 24 bytes per distinct threshold, use --bins\n"
+              << "\t\tto bound it as well.\n"
+              << "\t-T, --tmpdir\n\t\tDirectory for spilled runs, $TMPDIR or /tmp by default.\n"
+              << "\t-N, --nbc\n\t\tScore names of the input file by the native naive Bayes of nbc.py instead of reading score columns:\n"
+              << "\t\tsimple features are the last letter, complex ones are the last, the first and the second letters.\n"
+              << "\t\tInput lines are name and label separated by whitespace, --pc and --nc are the labels of the classes.\n"
+              << "\t\tScores are evaluated in memory, no scored files are written.\n"
+              << "\t-R, --train\n\t\tSamples file the naive Bayes is trained on, then the input file is scored and evaluated.\n"
+              << "\t-k, --folds\n\t\tCross validation of the naive Bayes on the input file instead of --train: samples are split into\n"
+              << "\t\tfolds at random by --seed, every fold is scored by the model of the others. Folds are evaluated in parallel\n"
+              << "\t\tand printed as a table with the mean of folds and the pooled curve of all of them.\n"
+              << "\t-U, --scores\n\t\tFile to write naive Bayes scores of samples to: name, label, score and, in cross validation, fold.\n"
+              << "\t-X, --serve\n\t\tRun evaluation server on the given Unix socket. Data sets are kept in memory between requests,\n"
+              << "\t\tsee server.h for the protocol. Threads count limits requests executed at once, idle clients\n"
+              << "\t\tdon't take threads.\n"
+              << "\t-Z, --client\n\t\tSend the command given after options to the server on the given Unix socket and print the response.\n"
+              << "\t\tBody of INGEST, RETRACT and QUERY commands is read from stdin, e.g. -Z sock INGEST model < data.tsv\n";
 }
 
+void print_queries(const std::vector<TOpFinder::TQuery>& queries, const std::string& column) {
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const TOpFinder::TQuery& query = queries[i];
+        if (!column.empty())
+            std::cout << column << "\t";
+        std::cout << query.TargetName << "\t";
+        if (query.ArgumentName.empty())
+            std::cout << "-\t-\t";
+        else
+            std::cout << query.ArgumentName << "\t" << query.ArgValue << "\t";
+        std::cout << query.Alpha << "\t";
+        if (!query.Found)
+            std::cout << "-\t-\t-" << std::endl;
+        else if (query.ArgumentName.empty())
+            std::cout << query.OptimalThreshold << "\t" << query.TargetValue << "\t-" << std::endl;
+        else
+            std::cout << query.OptimalThreshold << "\t" << query.TargetValue << "\t" << query.ArgumentValue << std::endl;
+    }
+}
+
+static int auc = 0;
+static int prauc = 0;
+static int averagePrecision = 0;
+static int stats = 0;
+static int frontier = 0;
+
+//NaN stands for a value which doesn't exist
+void print_value(double value) {
+    if (isnan(value))
+        std::cout << "\t-";
+    else
+        std::cout << "\t" << value;
+}
+
+void print_results(const std::string& name, const TOpFinder::TResults& results, bool target, bool argument) {
+    std::cout << name << "\t" << results.AUC;
+    if (prauc)
+        std::cout << "\t" << results.PRAUC;
+    if (averagePrecision)
+        std::cout << "\t" << results.AveragePrecision;
+    if (target) {
+        print_value(results.OptimalThreshold);
+        print_value(results.Target);
+        if (argument)
+            print_value(results.Argument);
+    }
+    std::cout << std::endl;
+}
+
+void print_header(const std::string& nameHeader, bool target, bool argument) {
+    std::cout << nameHeader << "\tAUC" << (prauc ? "\tPR AUC" : "") << (averagePrecision ? "\tAP" : "");
+    if (target)
+        std::cout << "\tOptimal threshold\tTarget function" << (argument ? "\tArgument" : "");
+    std::cout << std::endl;
+}
+
+//Results of a model of a table with its target found as a query: FindOptimalThreshold throws
+//if no threshold satisfies the argument, a model of a table gets "-" instead
+TOpFinder::TResults target_results(const TOpFinder& model, const std::vector<TOpFinder::TQuery>& target) {
+    TOpFinder::TResults results = model.GetResults();
+    if (!target.empty()) {
+        const TOpFinder::TQuery& query = target.front();
+        results.OptimalThreshold = query.Found ? query.OptimalThreshold : NAN;
+        results.Target = query.Found ? query.TargetValue : NAN;
+        results.Argument = query.Found ? query.ArgumentValue : NAN;
+    }
+    return results;
+}
+
+//Macro average of models, it has no threshold of its own
+TOpFinder::TResults average_results(const std::vector<TOpFinder::TResults>& models) {
+    TOpFinder::TResults average = TOpFinder::TResults();
+    for (size_t i = 0; i < models.size(); ++i) {
+        average.AUC += models[i].AUC / models.size();
+        average.PRAUC += models[i].PRAUC / models.size();
+        average.AveragePrecision += models[i].AveragePrecision / models.size();
+        average.Target += models[i].Target / models.size();
+        average.Argument += models[i].Argument / models.size();
+    }
+    average.OptimalThreshold = NAN;
+    return average;
+}
+
+static const std::string QUERIES_HEADER = "Target\tArgument\tArgval\tAlpha\tOptimal threshold\tTarget function\tArgument";
+
 /* default values */
 static const std::string DEFAULT_FORMAT_STRING = "%T:%p:%d:%r:%t:%f:%a:%n:%F";
 static const std::string DEFAULT_POINTS_COUNT = "10000";
@@ -65,32 +221,61 @@ static const std::string DEFAULT_ALPHA = "0.5";
 static const std::string DEFAULT_ARGUMENT_VALUE = "0.95";
 static const std::string DEFAULT_POSITIVE_CLASS = "1";
 static const std::string DEFAULT_NEGATIVE_CLASS = "0";
-
-static int auc = 0;
+static const std::string DEFAULT_THREADS_COUNT = "1";
+static const std::string DEFAULT_HISTOGRAM_RANGE = "0:1";
+static const std::string DEFAULT_CONFIDENCE = "0.95";
+static const std::string DEFAULT_SEED = "0";
 
 static struct option long_options[] =
 {
 /* These options set a flag. */
     {"auc",             no_argument, &auc, 1},
+    {"prauc",           no_argument, &prauc, 1},
+    {"ap",              no_argument, &averagePrecision, 1},
+    {"stats",           no_argument, &stats, 1},
+    {"frontier",        no_argument, &frontier, 1},
 
 /* These options don't set a flag.
 We distinguish them by their indices. */
     {"inputfile",       required_argument, 0, 'I'},
     {"actualcol",       required_argument, 0, 'A'},
     {"predictedcol",    required_argument, 0, 'P'},
+    {"weightcol",       required_argument, 0, 'G'},
+    {"groupcol",        required_argument, 0, 'g'},
+    {"classes",         required_argument, 0, 'c'},
     {"outputfile",      required_argument, 0, 'O'},
     {"formatstring",    required_argument, 0, 'F'},
     {"points",          required_argument, 0, 'n'},
     {"plot",            required_argument, 0, 'p'},
+    {"deviation",       required_argument, 0, 'D'},
     {"xaxis",           required_argument, 0, 'x'},
     {"yaxis",           required_argument, 0, 'y'},
     {"alpha",           required_argument, 0, 'a'},
     {"target",          required_argument, 0, 't'},
     {"argument",        required_argument, 0, 'Y'},
     {"argval",          required_argument, 0, 'M'},
+    {"sweep",           required_argument, 0, 's'},
+    {"queries",         required_argument, 0, 'Q'},
     {"pc",              required_argument, 0, 'q'},
     {"nc",              required_argument, 0, 'w'},
     {"C",               required_argument, 0, 'C'},
+    {"threads",         required_argument, 0, 'j'},
+    {"bins",            required_argument, 0, 'b'},
+    {"range",           required_argument, 0, 'r'},
+    {"partial",         required_argument, 0, 'W'},
+    {"merge",           required_argument, 0, 'm'},
+    {"cache",           required_argument, 0, 'K'},
+    {"bootstrap",       required_argument, 0, 'B'},
+    {"confidence",      required_argument, 0, 'L'},
+    {"seed",            required_argument, 0, 'S'},
+    {"memory",          required_argument, 0, 'E'},
+    {"tmpdir",          required_argument, 0, 'T'},
+    {"nbc",             required_argument, 0, 'N'},
+    {"train",           required_argument, 0, 'R'},
+    {"folds",           required_argument, 0, 'k'},
+    {"scores",          required_argument, 0, 'U'},
+    {"serve",           required_argument, 0, 'X'},
+    {"client",          required_argument, 0, 'Z'},
     {"help",            no_argument, 0, '?'},
     {0, 0, 0, 0}
 };
@@ -98,10 +283,14 @@ We distinguish them by their indices. */
 int main (int argc, char* argv[]) {
     int opt = 0;
     int long_index = 0;
-    std::string inputFileName, actualColumn, predictedColumn, outputFileName,
-           outputFormatString, pointsCount, plotFileName, plotXAxis, plotYAxis,
+    std::string inputFileName, actualColumn, predictedColumn, weightColumn, groupColumn, classesList, outputFileName,
+           outputFormatString, pointsCount, plotDeviation, plotFileName, plotXAxis, plotYAxis,
            alphaValue, targetFunction, argumentForFunction, argumentValue,
-           positiveClass, negativeClass, classBound;
+           positiveClass, negativeClass, classBound, threadsCount,
+           binsCount, histogramRange, partialFileName, cacheFileName, queriesFileName,
+           bootstrapCount, confidenceLevel, randomSeed, memoryLimit, tempDirectory, serverSocket, clientSocket,
+           nbcFeatures, trainFileName, foldsCount, sweepSteps, scoresFileName;
+    std::vector<std::string> mergeFileNames;
 
     outputFormatString = DEFAULT_FORMAT_STRING;
     pointsCount = DEFAULT_POINTS_COUNT;
@@ -111,17 +300,25 @@ int main (int argc, char* argv[]) {
     argumentValue = DEFAULT_ARGUMENT_VALUE;
     positiveClass = DEFAULT_POSITIVE_CLASS;
     negativeClass = DEFAULT_NEGATIVE_CLASS;
+    threadsCount = DEFAULT_THREADS_COUNT;
+    histogramRange = DEFAULT_HISTOGRAM_RANGE;
+    confidenceLevel = DEFAULT_CONFIDENCE;
+    randomSeed = DEFAULT_SEED;
 
 
-    while ((opt = getopt_long(argc, argv, "I:A:P:O:F:n:p:x:y:a:t:Y:M:q:w:C:?",
+    while ((opt = getopt_long(argc, argv, "I:A:P:G:g:c:O:F:n:D:p:x:y:a:t:Y:M:s:q:w:C:j:b:r:W:m:K:Q:B:L:S:E:T:N:R:k:U:X:Z:?",
             long_options, &long_index )) != -1) {
         switch (opt) {
             case 'I': inputFileName = optarg; break;
             case 'A': actualColumn = optarg; break;
             case 'P': predictedColumn = optarg; break;
+            case 'G': weightColumn = optarg; break;
+            case 'g': groupColumn = optarg; break;
+            case 'c': classesList = optarg; break;
             case 'O': outputFileName = optarg; break;
             case 'F': outputFormatString = optarg; break;
             case 'n': pointsCount = optarg; break;
+            case 'D': plotDeviation = optarg; break;
             case 'p': plotFileName = optarg; break;
             case 'x': plotXAxis = optarg; break;
             case 'y': plotYAxis = optarg; break;
@@ -129,13 +326,44 @@ int main (int argc, char* argv[]) {
             case 't': targetFunction = optarg; break;
             case 'Y': argumentForFunction = optarg; break;
             case 'M': argumentValue = optarg; break;
+            case 's': sweepSteps = optarg; break;
             case 'q': positiveClass = optarg; break;
             case 'w': negativeClass = optarg; break;
             case 'C': classBound = optarg; break;
+            case 'j': threadsCount = optarg; break;
+            case 'b': binsCount = optarg; break;
+            case 'r': histogramRange = optarg; break;
+            case 'W': partialFileName = optarg; break;
+            case 'm': mergeFileNames.push_back(optarg); break;
+            case 'K': cacheFileName = optarg; break;
+            case 'Q': queriesFileName = optarg; break;
+            case 'B': bootstrapCount = optarg; break;
+            case 'L': confidenceLevel = optarg; break;
+            case 'S': randomSeed = optarg; break;
+            case 'E': memoryLimit = optarg; break;
+            case 'T': tempDirectory = optarg; break;
+            case 'N': nbcFeatures = optarg; break;
+            case 'R': trainFileName = optarg; break;
+            case 'k': foldsCount = optarg; break;
+            case 'U': scoresFileName = optarg; break;
+            case 'X': serverSocket = optarg; break;
+            case 'Z': clientSocket = optarg; break;
             case '?': print_usage(); return 1;
         }
     }
 
+    if (stats)
+        TStats::Enable();
+
+    if (!clientSocket.empty()) {
+        std::string command;
+        for (int i = optind; i < argc; ++i)
+            command += (command.empty() ? "" : " ") + std::string(argv[i]);
+        bool hasBody = (command.compare(0, 6, "INGEST") == 0) || (command.compare(0, 7, "RETRACT") == 0)
+            || (command.compare(0, 5, "QUERY") == 0);
+        return RunClient(clientSocket, command, hasBody ? &std::cin : nullptr);
+    }
+
     //now.... second circle of parsing hell
     double alpha = atof(alphaValue.c_str());
     if ((alpha < 0) || (alpha > 1))
@@ -150,24 +378,310 @@ int main (int argc, char* argv[]) {
     if (fuzzy)
         positive = atoi(classBound.c_str());
 
+    int threads = atoi(threadsCount.c_str());
+    if (threads < 0)
+        throw std::runtime_error("Threads count should be non-negative.");
+
+    int bins = atoi(binsCount.c_str());
+    if (bins < 0)
+        throw std::runtime_error("Bins count should be non-negative.");
+    std::vector<std::string> range = split(histogramRange, ':');
+    if (range.size() != 2)
+        throw std::runtime_error("Histogram range should be in MIN:MAX format.");
+
+    double deviation = atof(plotDeviation.c_str());
+    if (deviation < 0)
+        throw std::runtime_error("Plot deviation should be non-negative.");
+
+    int replicates = atoi(bootstrapCount.c_str());
+    if (replicates < 0)
+        throw std::runtime_error("Bootstrap replicates count should be non-negative.");
+    double confidence = atof(confidenceLevel.c_str());
+    if ((confidence <= 0) || (confidence >= 1))
+        throw std::runtime_error("Confidence level should be in (0;1).");
+    uint64_t seed = strtoull(randomSeed.c_str(), nullptr, 10);
+
+    double memory = atof(memoryLimit.c_str());
+    if (memory < 0)
+        throw std::runtime_error("Memory limit should be non-negative.");
+
+    if (!serverSocket.empty()) {
+        TEvalServer server(serverSocket, TThreadPool::ThreadCount(threads));
+        server.Run();
+        return 0;
+    }
+
     std::replace(outputFormatString.begin(), outputFormatString.end(), ':', '\t');
 
+    std::vector<TOpFinder::TQuery> queries;
+    if (!queriesFileName.empty())
+        queries = TOpFinder::ReadQueriesFromFile(queriesFileName, alpha);
+
+    if (!cacheFileName.empty() && inputFileName.empty())
+        throw std::runtime_error("Cache can be used with input file only.");
+
+    int steps = atoi(sweepSteps.c_str());
+    if ((steps < 0) || (!sweepSteps.empty() && !steps))
+        throw std::runtime_error("Alpha sweep steps count should be positive.");
+    if ((steps || frontier) && (!groupColumn.empty() || (split(predictedColumn, ',').size() > 1) || !classesList.empty()
+                                || !foldsCount.empty()))
+        throw std::runtime_error("Alpha sweep is available for a single model only.");
+
+    int folds = atoi(foldsCount.c_str());
+    if (!nbcFeatures.empty()) {
+        if (inputFileName.empty())
+            throw std::runtime_error("Naive Bayes scorer reads samples from input file only.");
+        if ((folds < 0) || (folds == 1))
+            throw std::runtime_error("Folds count should be at least 2.");
+        if (!folds == trainFileName.empty())
+            throw std::runtime_error("Either train file or folds should be given to naive Bayes scorer.");
+        if (!groupColumn.empty() || !classesList.empty() || !weightColumn.empty() || !mergeFileNames.empty()
+            || !cacheFileName.empty() || (folds && replicates))
+            throw std::runtime_error("Naive Bayes scorer can't be combined with groups, classes, weights, merge or cache,"
+                                     " and cross validation with bootstrap.");
+        //scored rows are label and score
+        actualColumn = "0";
+        predictedColumn = "1";
+    } else if (!trainFileName.empty() || !foldsCount.empty() || !scoresFileName.empty())
+        throw std::runtime_error("Train file, folds and scores file are options of naive Bayes scorer.");
+
+
+    //several predicted columns or classes: the file is parsed once, models are evaluated in parallel
+    std::vector<std::string> predictedColumns = split(predictedColumn, ',');
+    std::vector<std::string> classes = split(classesList, ',');
+    if (!classes.empty() && (classes.size() != predictedColumns.size()))
+        throw std::runtime_error("One predicted column per class should be given.");
+    if (!groupColumn.empty() && ((predictedColumns.size() > 1) || !classes.empty() || !mergeFileNames.empty()
+                                 || !cacheFileName.empty() || replicates))
+        throw std::runtime_error("Groups can't be combined with several models, merge, cache or bootstrap.");
+    if (replicates && !weightColumn.empty() && (bins || !mergeFileNames.empty() || !cacheFileName.empty() || (memory > 0)))
+        throw std::runtime_error("Bootstrap of weighted records needs the curve of records, it can't be combined with"
+                                 " bins, merge, cache or memory limit.");
+    if (((predictedColumns.size() > 1) || !classes.empty()) && !mergeFileNames.empty())
+        throw std::runtime_error("Several models can't be merged from partial files, merge them one model at a time.");
+    if ((predictedColumns.size() > 1) || !classes.empty()) {
+        if (replicates)
+            throw std::runtime_error("Bootstrap is available for a single predicted column only.");
+        const std::vector<std::string>& names = classes.empty() ? predictedColumns : classes;
+        const std::string nameHeader = classes.empty() ? "Column" : "Class";
+        std::vector<TOpFinder> models;
+        for (size_t i = 0; i < predictedColumns.size(); ++i) {
+            int modelPositive = classes.empty() ? positive : atoi(classes[i].c_str());
+            models.push_back(TOpFinder(atoi(actualColumn.c_str()), atoi(predictedColumns[i].c_str()), modelPositive, negative, !fuzzy, alpha));
+            if (!classes.empty())
+                models.back().SetOneVsRest();
+            models.back().SetThreadCount(threads);
+            models.back().SetHistogram(bins, atof(range[0].c_str()), atof(range[1].c_str()));
+            models.back().SetMemoryLimit((size_t)(memory * (1 << 20)), tempDirectory);
+            if (!weightColumn.empty())
+                models.back().SetWeightColumn(atoi(weightColumn.c_str()));
+        }
+        std::vector<TOpFinder::TQuery> targetQuery;
+        if (!targetFunction.empty())
+            targetQuery.push_back(TOpFinder::TQuery(targetFunction, argumentForFunction, argVal, alpha));
+        std::vector<std::vector<TOpFinder::TQuery> > modelTargets(models.size(), targetQuery);
+        std::vector<std::vector<TOpFinder::TQuery> > modelQueries(models.size(), queries);
+        std::vector<TOpFinder*> finders;
+        for (size_t i = 0; i < models.size(); ++i)
+            finders.push_back(&models[i]);
+        bool cached = !cacheFileName.empty();
+        for (size_t i = 0; cached && (i < models.size()); ++i)
+            cached = models[i].ReadFromCache(inputFileName, cacheFileName + "." + names[i]);
+        if (!cached) {
+            TOpFinder::ReadFromStream(inputFileName, finders);
+            for (size_t i = 0; !cacheFileName.empty() && (i < models.size()); ++i)
+                models[i].WriteCacheToFile(inputFileName, cacheFileName + "." + names[i]);
+        }
+
+        {
+            TThreadPool pool(TThreadPool::ThreadCount(threads));
+            for (size_t i = 0; i < models.size(); ++i) {
+                pool.Add([&, i]() {
+                    std::string suffix = "." + names[i];
+                    models[i].Calculate();
+                    if (!partialFileName.empty())
+                        models[i].WritePartialToFile(partialFileName + suffix);
+                    if (!outputFileName.empty())
+                        models[i].WriteDataToFile(outputFileName + suffix, outputFormatString);
+                    if (!plotFileName.empty())
+                        models[i].WritePlotToFile(plotFileName + suffix, plotXAxis, plotYAxis, atoi(pointsCount.c_str()), deviation);
+                    models[i].FindOptimalThresholds(modelTargets[i]);
+                    models[i].FindOptimalThresholds(modelQueries[i]);
+                });
+            }
+            pool.Wait();
+        }
+
+        print_header(nameHeader, !targetFunction.empty(), !argumentForFunction.empty());
+        std::vector<TOpFinder::TResults> results;
+        for (size_t i = 0; i < models.size(); ++i) {
+            results.push_back(target_results(models[i], modelTargets[i]));
+            print_results(names[i], results.back(), !targetFunction.empty(), !argumentForFunction.empty());
+        }
+
+        if (!classes.empty()) {
+            //macro average has no threshold of its own, micro one is found on the pooled curve
+            print_results("Macro", average_results(results), !targetFunction.empty(), !argumentForFunction.empty());
+
+            TOpFinder micro(atoi(actualColumn.c_str()), 0, positive, negative, true, alpha);
+            micro.MergeCurves(std::vector<const TOpFinder*>(finders.begin(), finders.end()));
+            micro.Calculate();
+            std::vector<TOpFinder::TQuery> microTarget(targetQuery);
+            micro.FindOptimalThresholds(microTarget);
+            print_results("Micro", target_results(micro, microTarget), !targetFunction.empty(), !argumentForFunction.empty());
+        }
+
+        if (!queries.empty()) {
+            std::cout << std::endl << nameHeader << "\t" << QUERIES_HEADER << std::endl;
+            for (size_t i = 0; i < models.size(); ++i)
+                print_queries(modelQueries[i], names[i]);
+        }
+        if (stats)
+            TStats::Write(std::cerr);
+        return 0;
+    }
+
+    //every fold is scored by the model of all samples but its own, which is the one trained on the other folds
+    if (folds) {
+        TNaiveBayes::EFeatures features = TNaiveBayes::ParseFeatures(nbcFeatures);
+        std::vector<TNameSample> samples = TNaiveBayes::ReadSamples(inputFileName);
+        std::vector<size_t> sampleFolds = TNaiveBayes::AssignFolds(samples.size(), folds, seed);
+        TNaiveBayes all(features, positiveClass, negativeClass);
+        for (size_t i = 0; i < samples.size(); ++i)
+            all.Add(samples[i]);
+
+        std::vector<TOpFinder> models;
+        for (int i = 0; i < folds; ++i) {
+            models.push_back(TOpFinder(0, 1, positive, negative, !fuzzy, alpha));
+            models.back().SetThreadCount(threads);
+            models.back().SetHistogram(bins, atof(range[0].c_str()), atof(range[1].c_str()));
+        }
+        std::vector<TOpFinder::TQuery> targetQuery;
+        if (!targetFunction.empty())
+            targetQuery.push_back(TOpFinder::TQuery(targetFunction, argumentForFunction, argVal, alpha));
+        std::vector<std::vector<TOpFinder::TQuery> > modelTargets(models.size(), targetQuery);
+        std::vector<std::vector<TOpFinder::TQuery> > modelQueries(models.size(), queries);
+        std::vector<double> scores(samples.size());
+        {
+            TThreadPool pool(TThreadPool::ThreadCount(threads));
+            for (size_t i = 0; i < models.size(); ++i) {
+                pool.Add([&, i]() {
+                    TNaiveBayes model(all);
+                    std::vector<const TNameSample*> validation;
+                    for (size_t j = 0; j < samples.size(); ++j) {
+                        if (sampleFolds[j] == i) {
+                            model.Remove(samples[j]);
+                            validation.push_back(&samples[j]);
+                        }
+                    }
+                    std::string rows;
+                    std::vector<double> foldScores(validation.size());
+                    model.WriteScores(validation, rows, foldScores.data());
+                    for (size_t j = 0; j < validation.size(); ++j)
+                        scores[validation[j] - samples.data()] = foldScores[j];
+                    models[i].ReadFromMemory(rows.data(), rows.data() + rows.size());
+
+                    std::string suffix = "." + std::to_string(i);
+                    models[i].Calculate();
+                    if (!partialFileName.empty())
+                        models[i].WritePartialToFile(partialFileName + suffix);
+                    if (!outputFileName.empty())
+                        models[i].WriteDataToFile(outputFileName + suffix, outputFormatString);
+                    if (!plotFileName.empty())
+                        models[i].WritePlotToFile(plotFileName + suffix, plotXAxis, plotYAxis, atoi(pointsCount.c_str()), deviation);
+                    models[i].FindOptimalThresholds(modelTargets[i]);
+                    models[i].FindOptimalThresholds(modelQueries[i]);
+                });
+            }
+            pool.Wait();
+        }
+        if (!scoresFileName.empty())
+            TNaiveBayes::WriteScoresToFile(scoresFileName, samples, scores, sampleFolds);
+
+        print_header("Fold", !targetFunction.empty(), !argumentForFunction.empty());
+        std::vector<const TOpFinder*> finders;
+        std::vector<TOpFinder::TResults> results;
+        for (size_t i = 0; i < models.size(); ++i) {
+            results.push_back(target_results(models[i], modelTargets[i]));
+            print_results(std::to_string(i), results.back(), !targetFunction.empty(), !argumentForFunction.empty());
+            finders.push_back(&models[i]);
+        }
+        print_results("Mean", average_results(results), !targetFunction.empty(), !argumentForFunction.empty());
+
+        TOpFinder pooled(0, 1, positive, negative, true, alpha);
+        pooled.MergeCurves(finders);
+        pooled.Calculate();
+        std::vector<TOpFinder::TQuery> pooledTarget(targetQuery);
+        pooled.FindOptimalThresholds(pooledTarget);
+        print_results("Pooled", target_results(pooled, pooledTarget), !targetFunction.empty(), !argumentForFunction.empty());
+
+        if (!queries.empty()) {
+            std::cout << std::endl << "Fold\t" << QUERIES_HEADER << std::endl;
+            for (size_t i = 0; i < models.size(); ++i)
+                print_queries(modelQueries[i], std::to_string(i));
+        }
+        if (stats)
+            TStats::Write(std::cerr);
+        return 0;
+    }
 
     TOpFinder opfinder(atoi(actualColumn.c_str()), atoi(predictedColumn.c_str()), positive, negative, !fuzzy, alpha);
-    opfinder.ReadFromStream(inputFileName);
+    opfinder.SetThreadCount(threads);
+    opfinder.SetHistogram(bins, atof(range[0].c_str()), atof(range[1].c_str()));
+    opfinder.SetMemoryLimit((size_t)(memory * (1 << 20)), tempDirectory);
+    if (!weightColumn.empty())
+        opfinder.SetWeightColumn(atoi(weightColumn.c_str()));
+    std::vector<std::string> groupKeys;
+    std::vector<TOpFinder> groups;
+    if (!groupColumn.empty()) {
+        opfinder.SetGroupColumn(atoi(groupColumn.c_str()));
+        opfinder.ReadGroupsFromStream(inputFileName, groupKeys, groups);
+    } else if (!nbcFeatures.empty()) {
+        TNaiveBayes model(TNaiveBayes::ParseFeatures(nbcFeatures), positiveClass, negativeClass);
+        std::vector<TNameSample> samples = TNaiveBayes::ReadSamples(trainFileName);
+        for (size_t i = 0; i < samples.size(); ++i)
+            model.Add(samples[i]);
+        samples = TNaiveBayes::ReadSamples(inputFileName);
+        std::vector<const TNameSample*> scored;
+        for (size_t i = 0; i < samples.size(); ++i)
+            scored.push_back(&samples[i]);
+        std::string rows;
+        std::vector<double> scores(samples.size());
+        model.WriteScores(scored, rows, scores.data());
+        if (!scoresFileName.empty())
+            TNaiveBayes::WriteScoresToFile(scoresFileName, samples, scores, std::vector<size_t>());
+        opfinder.ReadFromMemory(rows.data(), rows.data() + rows.size());
+    } else if (!mergeFileNames.empty())
+        opfinder.ReadFromPartials(mergeFileNames);
+    else if (cacheFileName.empty())
+        opfinder.ReadFromStream(inputFileName);
+    else if (!opfinder.ReadFromCache(inputFileName, cacheFileName)) {
+        opfinder.ReadFromStream(inputFileName);
+        opfinder.WriteCacheToFile(inputFileName, cacheFileName);
+    }
     opfinder.Calculate();
 
+    if (!partialFileName.empty())
+        opfinder.WritePartialToFile(partialFileName);
+
     const TOpFinder::TResults& results = opfinder.GetResults();
 
-    if (auc)
+    if (auc) {
         std::cout << "AUC = " << results.AUC << std::endl;
+        if (results.AUCError > 0)
+            std::cout << "AUC error bound = " << results.AUCError << std::endl;
+    }
+    if (prauc)
+        std::cout << "PR AUC = " << results.PRAUC << std::endl;
+    if (averagePrecision)
+        std::cout << "Average precision = " << results.AveragePrecision << std::endl;
 
     if (!outputFileName.empty()) {
         opfinder.WriteDataToFile(outputFileName, outputFormatString);
     }
 
     if (!plotFileName.empty()) {
-        opfinder.WritePlotToFile(plotFileName, plotXAxis, plotYAxis, atoi(pointsCount.c_str()));
+        opfinder.WritePlotToFile(plotFileName, plotXAxis, plotYAxis, atoi(pointsCount.c_str()), deviation);
     }
 
     if (!targetFunction.empty()) {
@@ -178,5 +692,82 @@ int main (int argc, char* argv[]) {
         else
             std::cout << "\tArgument = " << results.Argument << std::endl;
     }
+
+    if (replicates) {
+        opfinder.Bootstrap(replicates, confidence, seed, targetFunction, argumentForFunction, argVal);
+        const TOpFinder::TBootstrapResults& bootstrap = opfinder.GetBootstrapResults();
+        std::cout << "AUC interval = [" << bootstrap.AUC.Lower << "; " << bootstrap.AUC.Upper << "]" << std::endl;
+        if (!targetFunction.empty()) {
+            if (bootstrap.Found) {
+                std::cout << "Optimal threshold interval = [" << bootstrap.OptimalThreshold.Lower << "; " << bootstrap.OptimalThreshold.Upper
+                          << "]\tTarget function interval = [" << bootstrap.Target.Lower << "; " << bootstrap.Target.Upper << "]" << std::endl;
+            }
+            if (bootstrap.Found < bootstrap.Replicates) {
+                std::cout << "Argument value is satisfied in " << bootstrap.Found << " of "
+                          << bootstrap.Replicates << " replicates" << std::endl;
+            }
+        }
+    }
+
+    if (!queries.empty()) {
+        opfinder.FindOptimalThresholds(queries);
+        std::cout << QUERIES_HEADER << std::endl;
+        print_queries(queries, "");
+    }
+
+    if (steps || frontier) {
+        std::vector<TOpFinder::TFrontierSegment> segments = opfinder.FindFmeasureFrontier();
+        if (segments.empty())
+            std::cerr << "No threshold passes positive records, F-measure is 0 for all alphas." << std::endl;
+        if (frontier && !segments.empty()) {
+            std::cout << "Alpha from\tAlpha to\tOptimal threshold\tPrecision\tRecall" << std::endl;
+            for (size_t i = 0; i < segments.size(); ++i) {
+                std::cout << segments[i].AlphaBegin << "\t" << segments[i].AlphaEnd << "\t" << segments[i].Threshold
+                          << "\t" << segments[i].Precision << "\t" << segments[i].Recall << std::endl;
+            }
+        }
+        if (steps && !segments.empty()) {
+            std::cout << "Alpha\tOptimal threshold\tF-measure\tPrecision\tRecall" << std::endl;
+            for (int i = 0; i <= steps; ++i) {
+                double sweepAlpha = (double)i / steps;
+                const TOpFinder::TFrontierSegment& segment = TOpFinder::FindFrontierSegment(segments, sweepAlpha);
+                std::cout << sweepAlpha << "\t" << segment.Threshold << "\t"
+                          << 1 / (sweepAlpha / segment.Precision + (1.0 - sweepAlpha) / segment.Recall)
+                          << "\t" << segment.Precision << "\t" << segment.Recall << std::endl;
+            }
+        }
+    }
+
+    if (!groupColumn.empty()) {
+        //a group may have no threshold satisfying the argument, so the target is a query as well
+        std::vector<TOpFinder::TQuery> targetQuery;
+        if (!targetFunction.empty())
+            targetQuery.push_back(TOpFinder::TQuery(targetFunction, argumentForFunction, argVal, alpha));
+        std::vector<std::vector<TOpFinder::TQuery> > groupTargets(groups.size(), targetQuery);
+        std::vector<std::vector<TOpFinder::TQuery> > groupQueries(groups.size(), queries);
+        {
+            TThreadPool pool(TThreadPool::ThreadCount(threads));
+            for (size_t i = 0; i < groups.size(); ++i) {
+                pool.Add([&, i]() {
+                    groups[i].Calculate();
+                    groups[i].FindOptimalThresholds(groupTargets[i]);
+                    groups[i].FindOptimalThresholds(groupQueries[i]);
+                });
+            }
+            pool.Wait();
+        }
+
+        std::cout << std::endl;
+        print_header("Group", !targetFunction.empty(), !argumentForFunction.empty());
+        for (size_t i = 0; i < groups.size(); ++i)
+            print_results(groupKeys[i], target_results(groups[i], groupTargets[i]), !targetFunction.empty(), !argumentForFunction.empty());
+        if (!queries.empty()) {
+            std::cout << std::endl << "Group\t" << QUERIES_HEADER << std::endl;
+            for (size_t i = 0; i < groups.size(); ++i)
+                print_queries(groupQueries[i], groupKeys[i]);
+        }
+    }
+    if (stats)
+        TStats::Write(std::cerr);
     return 0;
 }
@@ -0,0 +1,69 @@
+#include "mappedfile.h"
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+TMappedFile::TMappedFile()
+    : Data(nullptr)
+    , Length(0)
+{
+}
+
+TMappedFile::~TMappedFile() {
+    Close();
+}
+
+bool TMappedFile::Open(const std::string& fileName) {
+    Close();
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    Length = (size_t)st.st_size;
+    if (Length) {
+        Data = mmap(nullptr, Length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (Data == MAP_FAILED) {
+            Data = nullptr;
+            Length = 0;
+            close(fd);
+            return false;
+        }
+        madvise(Data, Length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return true;
+}
+
+void TMappedFile::Close() {
+    if (Data)
+        munmap(Data, Length);
+    Data = nullptr;
+    Length = 0;
+}
+
+const char* TMappedFile::Begin() const {
+    return (const char*)Data;
+}
+
+const char* TMappedFile::End() const {
+    return (const char*)Data + Length;
+}
+
+size_t TMappedFile::Size() const {
+    return Length;
+}
+
+void TMappedFile::Release(const char* begin, const char* end) {
+    static const size_t PAGE_SIZE = sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)begin + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    uintptr_t last = (uintptr_t)end / PAGE_SIZE * PAGE_SIZE;
+    if (first < last)
+        madvise((void*)first, last - first, MADV_DONTNEED);
+}
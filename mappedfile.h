@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+//Read-only memory mapping of a regular file. Pipes, terminals and other
+//non-seekable inputs can't be mapped, Open returns false for them.
+class TMappedFile {
+public:
+    TMappedFile();
+    ~TMappedFile();
+
+    bool Open(const std::string& fileName);
+    void Close();
+
+    const char* Begin() const;
+    const char* End() const;
+    size_t Size() const;
+
+    //Drops already scanned pages of [begin; end) from resident memory, the
+    //mapping itself stays valid and pages are read again on access
+    static void Release(const char* begin, const char* end);
+
+private:
+    TMappedFile(const TMappedFile&);
+    TMappedFile& operator=(const TMappedFile&);
+
+    void* Data;
+    size_t Length;
+};
@@ -0,0 +1,152 @@
+#include "metrickernel.h"
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define METRIC_KERNEL_AVX2
+#include <immintrin.h>
+#endif
+
+static const double EPS = TOpCounter::EPS;
+
+static inline unsigned Bit(TOpCounter::FieldOffset field) {
+    return 1u << field;
+}
+
+//Point by point, also finishes the tails of vectorized blocks
+static void CalculateScalar(const double* positivePassed, const double* negativePassed, size_t begin, size_t end,
+        double pc, double nc, double alpha, unsigned mask, double* const* columns) {
+    for (size_t i = begin; i < end; ++i) {
+        double tpc = pc - positivePassed[i];
+        double fpc = nc - negativePassed[i];
+        double tnc = negativePassed[i];
+        double fnc = positivePassed[i];
+        double precision = tpc / (tpc + fpc + EPS);
+        double recall = tpc / (tpc + fnc + EPS);
+        if (mask & Bit(TOpCounter::Precision))
+            columns[TOpCounter::Precision][i] = precision;
+        if (mask & Bit(TOpCounter::FDR))
+            columns[TOpCounter::FDR][i] = fpc / (tpc + fpc + EPS);
+        if (mask & Bit(TOpCounter::Recall))
+            columns[TOpCounter::Recall][i] = recall;
+        if (mask & Bit(TOpCounter::TPR))
+            columns[TOpCounter::TPR][i] = recall;
+        if (mask & Bit(TOpCounter::TNR))
+            columns[TOpCounter::TNR][i] = tnc / (tnc + fpc + EPS);
+        if (mask & Bit(TOpCounter::FPR))
+            columns[TOpCounter::FPR][i] = fpc / (tnc + fpc + EPS);
+        if (mask & Bit(TOpCounter::Accuracy))
+            columns[TOpCounter::Accuracy][i] = (tpc + tnc) / (tpc + tnc + fpc + fnc + EPS);
+        if (mask & Bit(TOpCounter::NPV))
+            columns[TOpCounter::NPV][i] = tnc / (tnc + fnc + EPS);
+        if (mask & Bit(TOpCounter::Fmeasure))
+            columns[TOpCounter::Fmeasure][i] = 1 / (alpha / precision + (1.0 - alpha) / recall);
+    }
+}
+
+#ifdef METRIC_KERNEL_AVX2
+//Same operations in the same order as the scalar code, four points at a time
+__attribute__((target("avx2")))
+static size_t CalculateAVX2(const double* positivePassed, const double* negativePassed, size_t size,
+        double pc, double nc, double alpha, unsigned mask, double* const* columns) {
+    const __m256d eps = _mm256_set1_pd(EPS);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d vpc = _mm256_set1_pd(pc);
+    const __m256d vnc = _mm256_set1_pd(nc);
+    const __m256d valpha = _mm256_set1_pd(alpha);
+    const __m256d vbeta = _mm256_set1_pd(1.0 - alpha);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m256d fnc = _mm256_loadu_pd(positivePassed + i);
+        __m256d tnc = _mm256_loadu_pd(negativePassed + i);
+        __m256d tpc = _mm256_sub_pd(vpc, fnc);
+        __m256d fpc = _mm256_sub_pd(vnc, tnc);
+        __m256d predicted = _mm256_add_pd(_mm256_add_pd(tpc, fpc), eps);
+        __m256d actual = _mm256_add_pd(_mm256_add_pd(tpc, fnc), eps);
+        __m256d precision = _mm256_div_pd(tpc, predicted);
+        __m256d recall = _mm256_div_pd(tpc, actual);
+        if (mask & Bit(TOpCounter::Precision))
+            _mm256_storeu_pd(columns[TOpCounter::Precision] + i, precision);
+        if (mask & Bit(TOpCounter::FDR))
+            _mm256_storeu_pd(columns[TOpCounter::FDR] + i, _mm256_div_pd(fpc, predicted));
+        if (mask & Bit(TOpCounter::Recall))
+            _mm256_storeu_pd(columns[TOpCounter::Recall] + i, recall);
+        if (mask & Bit(TOpCounter::TPR))
+            _mm256_storeu_pd(columns[TOpCounter::TPR] + i, recall);
+        if (mask & (Bit(TOpCounter::TNR) | Bit(TOpCounter::FPR))) {
+            __m256d negatives = _mm256_add_pd(_mm256_add_pd(tnc, fpc), eps);
+            if (mask & Bit(TOpCounter::TNR))
+                _mm256_storeu_pd(columns[TOpCounter::TNR] + i, _mm256_div_pd(tnc, negatives));
+            if (mask & Bit(TOpCounter::FPR))
+                _mm256_storeu_pd(columns[TOpCounter::FPR] + i, _mm256_div_pd(fpc, negatives));
+        }
+        if (mask & Bit(TOpCounter::Accuracy)) {
+            __m256d correct = _mm256_add_pd(tpc, tnc);
+            __m256d total = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(correct, fpc), fnc), eps);
+            _mm256_storeu_pd(columns[TOpCounter::Accuracy] + i, _mm256_div_pd(correct, total));
+        }
+        if (mask & Bit(TOpCounter::NPV)) {
+            __m256d rejected = _mm256_add_pd(_mm256_add_pd(tnc, fnc), eps);
+            _mm256_storeu_pd(columns[TOpCounter::NPV] + i, _mm256_div_pd(tnc, rejected));
+        }
+        if (mask & Bit(TOpCounter::Fmeasure)) {
+            __m256d denominator = _mm256_add_pd(_mm256_div_pd(valpha, precision), _mm256_div_pd(vbeta, recall));
+            _mm256_storeu_pd(columns[TOpCounter::Fmeasure] + i, _mm256_div_pd(one, denominator));
+        }
+    }
+    return i;
+}
+
+static bool HasAVX2() {
+    static const bool result = __builtin_cpu_supports("avx2");
+    return result;
+}
+#endif
+
+TMetricKernel::TMetricKernel(const std::vector<TOpCounter::FieldOffset>& fields, size_t blockSize)
+    : Mask(0)
+    , Size(blockSize)
+{
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (fields[i] < TOpCounter::FieldCount) {
+            Mask |= Bit(fields[i]);
+            Columns[fields[i]].resize(blockSize);
+        }
+    }
+}
+
+size_t TMetricKernel::BlockSize() const {
+    return Size;
+}
+
+void TMetricKernel::Calculate(const double* thresholds, const double* positivePassed, const double* negativePassed,
+        size_t size, double pc, double nc, double alpha) {
+    double* columns[TOpCounter::FieldCount];
+    for (size_t i = 0; i < TOpCounter::FieldCount; ++i)
+        columns[i] = Columns[i].data();
+
+    size_t done = 0;
+#ifdef METRIC_KERNEL_AVX2
+    if (HasAVX2())
+        done = CalculateAVX2(positivePassed, negativePassed, size, pc, nc, alpha, Mask, columns);
+#endif
+    CalculateScalar(positivePassed, negativePassed, done, size, pc, nc, alpha, Mask, columns);
+
+    if (Mask & Bit(TOpCounter::Threshold))
+        memcpy(columns[TOpCounter::Threshold], thresholds, size * sizeof(double));
+    if (Mask & Bit(TOpCounter::Alpha))
+        std::fill(columns[TOpCounter::Alpha], columns[TOpCounter::Alpha] + size, alpha);
+}
+
+const double* TMetricKernel::Column(TOpCounter::FieldOffset field) const {
+    return Columns[field].data();
+}
+
+const char* TMetricKernel::Implementation() {
+#ifdef METRIC_KERNEL_AVX2
+    if (HasAVX2())
+        return "avx2";
+#endif
+    return "scalar";
+}
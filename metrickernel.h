@@ -0,0 +1,29 @@
+#pragma once
+#include "opcounter.h"
+
+#include <vector>
+
+/*
+    Computes metric columns for a block of curve points at once, the same values as
+    TOpCounter::Calculate gives point by point. Only requested metrics (and those they
+    depend on) are computed. Columns are evaluated with AVX2 if the CPU supports it,
+    otherwise with scalar code; both round exactly the same way.
+*/
+class TMetricKernel {
+public:
+    explicit TMetricKernel(const std::vector<TOpCounter::FieldOffset>& fields, size_t blockSize = 1024);
+
+    size_t BlockSize() const;
+    //Fills columns for size <= BlockSize() points given by their passed counts
+    void Calculate(const double* thresholds, const double* positivePassed, const double* negativePassed,
+                   size_t size, double pc, double nc, double alpha);
+    //Column of a requested metric, indexed by point of the last block
+    const double* Column(TOpCounter::FieldOffset field) const;
+
+    static const char* Implementation();
+
+private:
+    std::vector<double> Columns[TOpCounter::FieldCount];
+    unsigned Mask;
+    size_t Size;
+};
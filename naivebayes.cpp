@@ -0,0 +1,172 @@
+#include "naivebayes.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+static const double UNSEEN_PROBABILITY = 1e-7;
+static const double MAX_VALUE_DIFFERENCE = 709.0;  //exp overflows beyond it
+static const uint32_t NO_LETTER = 0;                //second letter of one letter names
+
+//Lenient UTF-8 decoding, a byte which doesn't start a valid sequence is a letter of its own
+static uint32_t DecodeLetter(const char*& p, const char* end) {
+    unsigned char lead = *p++;
+    size_t length = (lead >= 0xF0) ? 3 : (lead >= 0xE0) ? 2 : (lead >= 0xC0) ? 1 : 0;
+    uint32_t letter = length ? (lead & (0x3F >> length)) : lead;
+    const char* next = p;
+    for (size_t i = 0; i < length; ++i, ++next) {
+        if ((next == end) || ((*next & 0xC0) != 0x80))
+            return lead;
+        letter = (letter << 6) | (*next & 0x3F);
+    }
+    p = next;
+    return letter;
+}
+
+static uint32_t LastLetter(const std::string& name) {
+    const char* begin = name.data();
+    const char* end = begin + name.size();
+    const char* p = end - 1;
+    while ((p > begin) && (end - p < 4) && ((*p & 0xC0) == 0x80))
+        --p;
+    const char* last = p;
+    uint32_t letter = DecodeLetter(last, end);
+    return (last == end) ? letter : (unsigned char)end[-1];
+}
+
+TNaiveBayes::TNaiveBayes(EFeatures features, const std::string& positive, const std::string& negative)
+    : Features(features)
+    , Samples(0)
+{
+    Labels[0] = negative;
+    Labels[1] = positive;
+    ClassCounts[0] = ClassCounts[1] = 0;
+}
+
+TNaiveBayes::EFeatures TNaiveBayes::ParseFeatures(const std::string& name) {
+    if (name == "simple")
+        return Simple;
+    if (name == "complex")
+        return Complex;
+    throw std::runtime_error("Unknown naive Bayes features " + name + ", should be simple or complex.");
+}
+
+std::vector<TNameSample> TNaiveBayes::ReadSamples(const std::string& fileName) {
+    std::ifstream in(fileName);
+    if (!in)
+        throw std::runtime_error("Can't read samples file " + fileName);
+    std::vector<TNameSample> samples;
+    std::string line, extra;
+    for (size_t lineNumber = 1; std::getline(in, line); ++lineNumber) {
+        std::istringstream fields(line);
+        TNameSample sample;
+        fields >> sample.Name >> sample.Label;
+        if (sample.Name.empty())
+            continue;
+        if (sample.Label.empty() || (fields >> extra))
+            std::cerr << "Name and label expected in line " << lineNumber << " : " << line << std::endl;
+        else
+            samples.push_back(sample);
+    }
+    return samples;
+}
+
+std::vector<size_t> TNaiveBayes::AssignFolds(size_t samples, size_t folds, uint64_t seed) {
+    std::mt19937_64 generator(seed);
+    std::vector<size_t> result(samples);
+    for (size_t i = 0; i < samples; ++i)
+        result[i] = generator() % folds;
+    return result;
+}
+
+void TNaiveBayes::Add(const TNameSample& sample) {
+    Update(sample, 1);
+}
+
+void TNaiveBayes::Remove(const TNameSample& sample) {
+    Update(sample, -1);
+}
+
+void TNaiveBayes::Update(const TNameSample& sample, int64_t delta) {
+    Samples += delta;
+    size_t label = (sample.Label == Labels[1]) ? 1 : (sample.Label == Labels[0]) ? 0 : 2;
+    if (label == 2)
+        return;
+    ClassCounts[label] += delta;
+    uint64_t features[Complex];
+    size_t count = GetFeatures(sample.Name, features);
+    for (size_t i = 0; i < count; ++i) {
+        int64_t& featureCount = FeatureCounts[label][features[i]];
+        featureCount += delta;
+        if (!featureCount)
+            FeatureCounts[label].erase(features[i]);
+    }
+}
+
+//Feature is the letter with its position in the high half, so the same letter
+//is a different feature as the first and as the last one
+size_t TNaiveBayes::GetFeatures(const std::string& name, uint64_t* features) const {
+    features[0] = LastLetter(name);
+    if (Features == Simple)
+        return 1;
+    const char* p = name.data();
+    const char* end = p + name.size();
+    uint64_t first = DecodeLetter(p, end);
+    uint64_t second = (p < end) ? DecodeLetter(p, end) : NO_LETTER;
+    features[1] = (1ULL << 32) | first;
+    features[2] = (2ULL << 32) | second;
+    return Complex;
+}
+
+double TNaiveBayes::GetClassValue(size_t label, const uint64_t* features, size_t count) const {
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        std::unordered_map<uint64_t, int64_t>::const_iterator it = FeatureCounts[label].find(features[i]);
+        double probability = (it == FeatureCounts[label].end()) ? UNSEEN_PROBABILITY
+                             : (double)it->second / (double)ClassCounts[label];
+        sum += -log(probability);
+    }
+    return -log((double)ClassCounts[label] / (double)Samples) + sum;
+}
+
+double TNaiveBayes::Score(const std::string& name) const {
+    if (!ClassCounts[0] || !ClassCounts[1])
+        throw std::runtime_error("Training samples should contain both " + Labels[1] + " and " + Labels[0] + " labels.");
+    uint64_t features[Complex];
+    size_t count = GetFeatures(name, features);
+    double positive = GetClassValue(1, features, count);
+    double negative = GetClassValue(0, features, count);
+    if (fabs(positive - negative) < MAX_VALUE_DIFFERENCE)
+        return 1.0 / (1.0 + exp(positive - negative));
+    return (positive > negative) ? 0.0 : 1.0;
+}
+
+void TNaiveBayes::WriteScores(const std::vector<const TNameSample*>& samples, std::string& rows, double* scores) const {
+    char score[32];
+    for (size_t i = 0; i < samples.size(); ++i) {
+        double value = Score(samples[i]->Name);
+        if (scores)
+            scores[i] = value;
+        snprintf(score, sizeof(score), "%.17g", value);
+        rows.append(samples[i]->Label).append(1, '\t').append(score).append(1, '\n');
+    }
+}
+
+void TNaiveBayes::WriteScoresToFile(const std::string& fileName, const std::vector<TNameSample>& samples,
+        const std::vector<double>& scores, const std::vector<size_t>& folds) {
+    std::ofstream out(fileName);
+    if (!out)
+        throw std::runtime_error("Can't write scores file " + fileName);
+    char score[32];
+    for (size_t i = 0; i < samples.size(); ++i) {
+        snprintf(score, sizeof(score), "%.17g", scores[i]);
+        out << samples[i].Name << "\t" << samples[i].Label << "\t" << score;
+        if (!folds.empty())
+            out << "\t" << folds[i];
+        out << "\n";
+    }
+}
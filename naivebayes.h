@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct TNameSample {
+    std::string Name;
+    std::string Label;
+};
+
+/*
+    Naive Bayes over letters of names, the native counterpart of nbc.py. Features are the
+    last letter (simple) or the last, the first and the second letters (complex), letters are
+    UTF-8 code points. Probabilities and scores are computed the way nbc.py does, in the same
+    order of operations, so scores are the same as the ones it writes:
+        P(C) = count(C) / samples, P(F|C) = count(F, C) / count(C), unseen features get 1e-7;
+        score is the probability of the positive class by the logistic of the difference of
+        -log P(C) - sum(log P(F|C)) of both classes.
+    The model keeps counts rather than probabilities, so a model of the training folds is the
+    one of all samples with the validation fold removed and isn't trained from scratch.
+*/
+class TNaiveBayes {
+public:
+    enum EFeatures {
+        Simple = 1,
+        Complex = 3
+    };
+
+    TNaiveBayes(EFeatures features, const std::string& positive, const std::string& negative);
+
+    static EFeatures ParseFeatures(const std::string& name);
+    //Lines of name and label separated by whitespace, malformed lines are reported and skipped
+    static std::vector<TNameSample> ReadSamples(const std::string& fileName);
+    //Random fold of every sample, the same for a given seed
+    static std::vector<size_t> AssignFolds(size_t samples, size_t folds, uint64_t seed);
+
+    void Add(const TNameSample& sample);
+    void Remove(const TNameSample& sample);
+    //Probability of the positive class
+    double Score(const std::string& name) const;
+    //Appends "label\tscore" rows of the samples for TOpFinder::ReadFromMemory,
+    //scores are stored by the order of samples as well if given
+    void WriteScores(const std::vector<const TNameSample*>& samples, std::string& rows, double* scores = nullptr) const;
+    //Rows of name, label and score with full precision, and fold of the sample in cross validation
+    static void WriteScoresToFile(const std::string& fileName, const std::vector<TNameSample>& samples,
+                                  const std::vector<double>& scores, const std::vector<size_t>& folds);
+
+private:
+    void Update(const TNameSample& sample, int64_t delta);
+    size_t GetFeatures(const std::string& name, uint64_t* features) const;
+    double GetClassValue(size_t label, const uint64_t* features, size_t count) const;
+
+    EFeatures Features;
+    std::string Labels[2];                                  //negative, positive
+    int64_t Samples;                                        //of all labels
+    int64_t ClassCounts[2];
+    std::unordered_map<uint64_t, int64_t> FeatureCounts[2];
+};
@@ -0,0 +1,106 @@
+#include "onlinecurve.h"
+
+#include <math.h>
+#include <stdexcept>
+
+void TFenwickTree::Reset(size_t size) {
+    Tree.assign(size, 0);
+}
+
+size_t TFenwickTree::Size() const {
+    return Tree.size();
+}
+
+void TFenwickTree::Add(size_t index, double value) {
+    for (++index; index <= Tree.size(); index += index & (~index + 1))
+        Tree[index - 1] += value;
+}
+
+double TFenwickTree::Prefix(size_t end) const {
+    double sum = 0;
+    for (; end; end &= end - 1)
+        sum += Tree[end - 1];
+    return sum;
+}
+
+TOnlineCurve::TOnlineCurve(size_t bins, double min, double max) {
+    if (!bins)
+        throw std::runtime_error("Online curve needs at least one bin.");
+    Histogram.Reset(bins, min, max);
+    Clear();
+}
+
+void TOnlineCurve::Clear() {
+    Histogram.Clear();
+    PositiveTree.Reset(Histogram.Size());
+    NegativeTree.Reset(Histogram.Size());
+    PC = 0;
+    NC = 0;
+    Ordered = 0;
+    Tied = 0;
+}
+
+void TOnlineCurve::Add(double score, bool positive, double weight) {
+    bool outside;
+    size_t bin = Histogram.Bin(score, outside);
+    Histogram.Outside += outside;
+    Update(bin, positive, weight);
+}
+
+void TOnlineCurve::Remove(double score, bool positive, double weight) {
+    bool outside;
+    size_t bin = Histogram.Bin(score, outside);
+    double count = positive ? Histogram.Positives[bin] : Histogram.Negatives[bin];
+    if (weight > count + TOpCounter::EPS)
+        throw std::runtime_error("Removed records haven't been added to the online curve.");
+    Histogram.Outside -= outside;
+    Update(bin, positive, -weight);
+}
+
+void TOnlineCurve::Update(size_t bin, bool positive, double weight) {
+    double& count = positive ? Histogram.Positives[bin] : Histogram.Negatives[bin];
+    count += weight;
+    //removals shouldn't leave rounding noise in bins which are empty now
+    if (fabs(count) <= TOpCounter::EPS) {
+        weight -= count;
+        count = 0;
+    }
+    if (positive) {
+        Ordered += weight * NegativeTree.Prefix(bin);
+        Tied += weight * Histogram.Negatives[bin];
+        PositiveTree.Add(bin, weight);
+        PC += weight;
+    } else {
+        Ordered += weight * (PC - PositiveTree.Prefix(bin + 1));
+        Tied += weight * Histogram.Positives[bin];
+        NegativeTree.Add(bin, weight);
+        NC += weight;
+    }
+}
+
+const TOpFinderHistogram& TOnlineCurve::GetHistogram() const {
+    return Histogram;
+}
+
+double TOnlineCurve::GetPositiveCount() const {
+    return PC;
+}
+
+double TOnlineCurve::GetNegativeCount() const {
+    return NC;
+}
+
+void TOnlineCurve::CalculateCounter(double threshold, double alpha, TOpCounter& counter) const {
+    bool outside;
+    size_t bin = Histogram.Bin(threshold, outside);
+    counter.SetParameters(alpha, Histogram.Threshold(bin), 0);
+    counter.Calculate(PositiveTree.Prefix(bin), PC, NegativeTree.Prefix(bin), NC);
+}
+
+double TOnlineCurve::GetAUC() const {
+    return (PC && NC) ? (Ordered + Tied / 2.0) / (PC * NC) : 0;
+}
+
+double TOnlineCurve::GetAUCError() const {
+    return (PC && NC) ? Tied / (2.0 * PC * NC) : 0;
+}
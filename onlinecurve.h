@@ -0,0 +1,57 @@
+#pragma once
+#include "opfinder.h"
+
+//Prefix sums of a fixed size array, both updates and queries take O(log n)
+class TFenwickTree {
+public:
+    void Reset(size_t size);
+    size_t Size() const;
+    void Add(size_t index, double value);
+    //Sum of [0; end)
+    double Prefix(size_t end) const;
+
+private:
+    std::vector<double> Tree;
+};
+
+/*
+    Histogram curve updated record by record for monitoring of live traffic. Bins are the
+    ones of TOpFinderHistogram, so results are the same as of a finder in histogram mode
+    which has read the records currently added. Records can be removed as well, e.g. when
+    they leave a sliding window. Every update takes O(log bins):
+        - passed counts of bins are kept in Fenwick trees, so metrics at a threshold are
+          computed without a scan;
+        - AUC is kept as a sum over pairs of positive and negative records, an added record
+          changes it by the number of records of the other class below and in its bin.
+    Optimal thresholds still need a scan of bins, TOpFinder::ReadFromOnline builds a curve
+    of them in O(bins) without touching the records.
+*/
+class TOnlineCurve {
+public:
+    TOnlineCurve(size_t bins, double min = 0.0, double max = 1.0);
+
+    void Add(double score, bool positive, double weight = 1.0);
+    //Throws if the bin has fewer records of the class than the removed weight
+    void Remove(double score, bool positive, double weight = 1.0);
+    void Clear();
+
+    const TOpFinderHistogram& GetHistogram() const;
+    double GetPositiveCount() const;
+    double GetNegativeCount() const;
+    //Threshold is rounded down to the lower edge of its bin
+    void CalculateCounter(double threshold, double alpha, TOpCounter& counter) const;
+    double GetAUC() const;
+    //See TOpFinderHistogram
+    double GetAUCError() const;
+
+private:
+    void Update(size_t bin, bool positive, double weight);
+
+    TOpFinderHistogram Histogram;
+    TFenwickTree PositiveTree;
+    TFenwickTree NegativeTree;
+    double PC;
+    double NC;
+    double Ordered;     //weight of pairs where the positive record is in a higher bin
+    double Tied;        //weight of pairs sharing a bin
+};
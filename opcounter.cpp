@@ -1,5 +1,5 @@
 #include "opcounter.h"
-#include <sstream>
+#include "opformat.h"
 
 TOpCounter::TOpCounter(double alpha, double threshold)
 {
@@ -25,9 +25,9 @@ void TOpCounter::SetParameters(double alpha, double threshold, int actual) {
     Actual = actual;
 }
 
-void TOpCounter::Calculate(size_t positiveCountPassed, size_t positiveCountTotal,
-        size_t negativeCountPassed, size_t negativeCountTotal, bool asc)  {
-    size_t tpc, fpc, tnc, fnc;
+void TOpCounter::Calculate(double positiveCountPassed, double positiveCountTotal,
+        double negativeCountPassed, double negativeCountTotal, bool asc)  {
+    double tpc, fpc, tnc, fnc;
     if (asc) {
         tpc = positiveCountTotal - positiveCountPassed;
         fpc = negativeCountTotal - negativeCountPassed;
@@ -39,14 +39,14 @@ void TOpCounter::Calculate(size_t positiveCountPassed, size_t positiveCountTotal
         tnc = negativeCountTotal - negativeCountPassed;
         fnc = positiveCountTotal - positiveCountPassed;
     }
-    Values[Precision] = (double)tpc / (double)(tpc + fpc + EPS);
-    Values[FDR] = (double)fpc / (double)(tpc + fpc + EPS);
-    Values[Recall] = (double)tpc / (double)(tpc + fnc + EPS);
+    Values[Precision] = tpc / (tpc + fpc + EPS);
+    Values[FDR] = fpc / (tpc + fpc + EPS);
+    Values[Recall] = tpc / (tpc + fnc + EPS);
     Values[TPR] = Values[Recall];
-    Values[TNR] = (double)tnc / (double)(tnc + fpc + EPS);
-    Values[FPR] = (double)fpc / (double)(tnc + fpc + EPS);
-    Values[Accuracy] = (double)(tpc + tnc) / (double)(tpc + tnc + fpc + fnc + EPS);
-    Values[NPV] = (double)tnc / (double)(tnc + fnc + EPS);
+    Values[TNR] = tnc / (tnc + fpc + EPS);
+    Values[FPR] = fpc / (tnc + fpc + EPS);
+    Values[Accuracy] = (tpc + tnc) / (tpc + tnc + fpc + fnc + EPS);
+    Values[NPV] = tnc / (tnc + fnc + EPS);
     Values[Fmeasure] = 1 / (Values[Alpha] / Values[Precision] + (1.0 - Values[Alpha]) / Values[Recall]);
 }
 
@@ -90,23 +90,9 @@ TOpCounter::FieldOffset TOpCounter::GetFieldOffset(const std::string& str) {
 }
 
 void TOpCounter::GetLine(const std::string& format, std::string& destination) const {
-    std::stringstream ss;
-    FieldOffset offset;
-
-    for (size_t i = 0; i < format.length(); ++i) {
-        if (format[i] != '%')
-            ss << format[i];
-        else {
-            ++i;
-            offset = GetFieldOffset(std::string(1, format[i]));
-            if (offset != InvalidOffset)
-                ss << Values[offset];
-            else
-                ss << '%' << format[i];
-        }
-    }
-
-    destination = ss.str();
+    TOpFormat opFormat(format);
+    std::vector<char> line(opFormat.MaxLength());
+    destination.assign(line.data(), opFormat.Write(*this, line.data()));
 }
 
 double TOpCounter::GetValue(const FieldOffset offset) const {
@@ -29,8 +29,9 @@ public:
     void Reset();
     void Reset(double alpha, double threshold);
     void SetParameters(double alpha, double threshold, int actual);
-    void Calculate(size_t positiveCountPassed, size_t positiveCountTotal,
-                   size_t negativeCountPassed, size_t negativeCountTotal, bool asc = true);
+    //Counts are sums of record weights, i.e. numbers of records if there are no weights
+    void Calculate(double positiveCountPassed, double positiveCountTotal,
+                   double negativeCountPassed, double negativeCountTotal, bool asc = true);
     void GetLine(const std::string& format, std::string& destination) const;
     double GetValue(const FieldOffset offset) const;
     bool operator<(const TOpCounter& c) const;
@@ -38,7 +39,7 @@ public:
     int Actual;             //Actual value for this threshold
 
     static FieldOffset GetFieldOffset(const std::string& str);
+    static constexpr double EPS = 1e-12;
 private:
     std::array<double, FieldCount> Values;
-    static constexpr double EPS = 1e-12;
 };
@@ -1,12 +1,28 @@
 #include "opfinder.h"
 #include "common.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "scoresort.h"
+#include "partial.h"
+#include "opformat.h"
+#include "onlinecurve.h"
+#include "stats.h"
 
 #include <stdlib.h>
+#include <math.h>
+#include <malloc.h>
+#include <string.h>
+#include <unistd.h>
 #include <iostream>
 #include <istream>
 #include <fstream>
+#include <sstream>
 #include <memory>
 #include <algorithm>
+#include <numeric>
+#include <queue>
+#include <map>
+#include <functional>
 #include <stdexcept>
 
 bool TOpFinderPlot::operator<(const TOpFinderPlot& p) const {
@@ -18,88 +34,574 @@ bool TOpFinderPlot::operator<(const TOpFinderPlot& p) const {
         return false;
 }
 
+size_t TOpFinderData::Size() const {
+    return Positives.size() + Negatives.size();
+}
+
+void TOpFinderData::Clear() {
+    std::vector<double>().swap(Positives);
+    std::vector<double>().swap(Negatives);
+    std::vector<double>().swap(PositiveWeights);
+    std::vector<double>().swap(NegativeWeights);
+}
+
+size_t TOpFinderCurve::Size() const {
+    return Thresholds.size();
+}
+
+void TOpFinderCurve::Clear() {
+    std::vector<double>().swap(Thresholds);
+    std::vector<double>().swap(PositivePassed);
+    std::vector<double>().swap(NegativePassed);
+    std::vector<double>().swap(PositiveRecords);
+    std::vector<double>().swap(NegativeRecords);
+}
+
+TOpFinderHistogram::TOpFinderHistogram()
+    : Min(0)
+    , Max(1)
+    , Outside(0)
+{
+}
+
+void TOpFinderHistogram::Reset(size_t bins, double min, double max) {
+    Min = min;
+    Max = max;
+    Positives.assign(bins, 0);
+    Negatives.assign(bins, 0);
+    Outside = 0;
+}
+
+void TOpFinderHistogram::Clear() {
+    Reset(Size(), Min, Max);
+}
+
+size_t TOpFinderHistogram::Size() const {
+    return Positives.size();
+}
+
+size_t TOpFinderHistogram::Bin(double score, bool& outside) const {
+    double position = (score - Min) / (Max - Min) * (double)Size();
+    outside = false;
+    if (!(position >= 0)) {
+        outside = true;
+        return 0;
+    }
+    if (position >= (double)Size()) {
+        outside = (score != Max);
+        return Size() - 1;
+    }
+    return (size_t)position;
+}
+
+void TOpFinderHistogram::Add(double score, bool positive, double weight) {
+    bool outside;
+    size_t bin = Bin(score, outside);
+    Outside += outside;
+    if (positive)
+        Positives[bin] += weight;
+    else
+        Negatives[bin] += weight;
+}
+
+void TOpFinderHistogram::Merge(const TOpFinderHistogram& histogram) {
+    for (size_t i = 0; i < Size(); ++i) {
+        Positives[i] += histogram.Positives[i];
+        Negatives[i] += histogram.Negatives[i];
+    }
+    Outside += histogram.Outside;
+}
+
+double TOpFinderHistogram::Threshold(size_t bin) const {
+    return Min + (Max - Min) * (double)bin / (double)Size();
+}
+
+TOpFinder::TReadChunk::TReadChunk(const std::vector<TOpFinder*>& finders)
+    : Lines(0)
+    , Records(0)
+    , Finished(false)
+    , Scores(finders.size())
+{
+    for (size_t i = 0; i < finders.size(); ++i)
+        Columns.push_back(TReadColumn(finders.front()->Grouped ? TOpFinderHistogram() : finders[i]->Histogram,
+                                      finders.front()->Weighted, finders.front()->Grouped));
+}
+
+uint32_t TOpFinder::TReadChunk::GetGroup(const char* begin, const char* end) {
+    Key.assign(begin, end);
+    std::unordered_map<std::string, uint32_t>::const_iterator it = KeyIds.find(Key);
+    if (it != KeyIds.end())
+        return it->second;
+    KeyIds.insert(std::make_pair(Key, (uint32_t)Keys.size()));
+    Keys.push_back(Key);
+    return Keys.size() - 1;
+}
+
+void TOpFinder::TReadColumn::Add(double score, bool positive, double weight, uint32_t group) {
+    if (Histogram.Size()) {
+        Histogram.Add(score, positive, weight);
+    } else if (positive) {
+        Positives.push_back(score);
+        if (Weighted)
+            PositiveWeights.push_back(weight);
+        if (Grouped)
+            PositiveGroups.push_back(group);
+    } else {
+        Negatives.push_back(score);
+        if (Weighted)
+            NegativeWeights.push_back(weight);
+        if (Grouped)
+            NegativeGroups.push_back(group);
+    }
+}
+
 TOpFinder::TOpFinder(size_t actual, size_t predicted, int positive, int negative, bool fixed, double alpha)
     : ActualPosition(actual)
     , PredictedPosition(predicted)
+    , WeightPosition(0)
+    , Weighted(false)
     , Alpha(alpha)
     , FixedClass(fixed)
+    , OneVsRest(false)
     , PositiveClass(positive)
     , NegativeClass(negative)
+    , ThreadCount(1)
+    , MemoryLimit(0)
+    , GroupPosition(0)
+    , Grouped(false)
+    , Binned(false)
 {
-    Data.clear();
+}
+
+void TOpFinder::SetThreadCount(size_t threads) {
+    ThreadCount = TThreadPool::ThreadCount(threads);
+}
+
+void TOpFinder::SetHistogram(size_t bins, double min, double max) {
+    if (bins && !(min < max))
+        throw std::runtime_error("Histogram range is empty");
+    Histogram.Reset(bins, min, max);
+}
+
+void TOpFinder::SetWeightColumn(size_t weight) {
+    WeightPosition = weight;
+    Weighted = true;
+}
+
+void TOpFinder::SetOneVsRest() {
+    FixedClass = true;
+    OneVsRest = true;
+}
+
+void TOpFinder::SetMemoryLimit(size_t bytes, const std::string& tempDirectory) {
+    MemoryLimit = bytes;
+    TempDirectory = tempDirectory;
+}
+
+void TOpFinder::SetGroupColumn(size_t group) {
+    GroupPosition = group;
+    Grouped = true;
 }
 
 void TOpFinder::ReadFromStream(const std::string& inputFileName) {
-    std::string line;
-    std::vector<std::string> fields;
-    TOpCounter st;
+    ReadFromStream(inputFileName, std::vector<TOpFinder*>(1, this));
+}
 
-    std::unique_ptr<std::istream> inputStream;
-    if (!inputFileName.empty()) {
-        inputStream.reset(new std::ifstream(inputFileName));
-    } else {
-        inputStream.reset(&std::cin);
+size_t TOpFinder::ReadFromMemory(const char* begin, const char* end) {
+    std::vector<TOpFinder*> finders(1, this);
+    StartReading(finders);
+    std::vector<TReadChunk> chunks;
+    ReadFromBuffer(begin, end, false, finders, chunks);
+    size_t rejected = 0;
+    for (size_t i = 0; i < chunks.size(); ++i)
+        rejected += chunks[i].Errors.size();
+    FinishReading(chunks, finders);
+    return rejected;
+}
+
+void TOpFinder::StartReading(const std::vector<TOpFinder*>& finders) {
+    for (size_t i = 0; i < finders.size(); ++i) {
+        finders[i]->Data.Clear();
+        finders[i]->Histogram.Clear();
+        finders[i]->PC = 0;
+        finders[i]->NC = 0;
     }
+}
 
-    Data.clear();
-    PC = 0; NC = 0;
-    size_t lineCounter = 0;
-    double predicted;
-    int actual;
+void TOpFinder::ReadFromStream(const std::string& inputFileName, const std::vector<TOpFinder*>& finders) {
+    StartReading(finders);
+    TSpill spill(finders);
+    std::vector<TReadChunk> chunks;
+    ReadChunks(inputFileName, finders, chunks, spill);
+    FinishReading(chunks, finders, &spill);
+}
 
-    while (std::getline(*(inputStream.get()), line)) {
-        if (line.empty())
-            break;
-        fields.clear();
-        ++lineCounter;
-        split(line, '\t', fields);
-        if (PredictedPosition >= fields.size()) {
-            std::cerr << "Predicted class column doesn't exist in line " << lineCounter << " : " << line << std::endl;
-            continue;
-        }
-        if (ActualPosition >= fields.size()) {
-            std::cerr << "Actual class column doesn't exist in line " << lineCounter << " : " << line << std::endl;
-            continue;
-        }
-        try {
-            predicted = atof(fields[PredictedPosition].c_str());
-        } catch (...) {
-            std::cerr << "Predicted class value = " << fields[PredictedPosition]
-                 << " is not double. Ignoring line : " << lineCounter << std::endl;
-            continue;
+void TOpFinder::ReadGroupsFromStream(const std::string& inputFileName, std::vector<std::string>& keys,
+        std::vector<TOpFinder>& groups) {
+    std::vector<TOpFinder*> finders(1, this);
+    StartReading(finders);
+    TSpill spill(finders);
+    std::vector<TReadChunk> chunks;
+    ReadChunks(inputFileName, finders, chunks, spill);
+    SplitGroups(chunks, keys, groups);
+
+    std::vector<TOpFinder*> groupFinders;
+    size_t outside = 0;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        groupFinders.push_back(&groups[i]);
+        outside += groups[i].Histogram.Outside;
+    }
+    FinishColumns(groupFinders);
+    for (size_t i = 0; i < groups.size(); ++i)
+        TStats::Add(TStats::DistinctThresholds, groups[i].Curve.Size());
+    if (outside)
+        std::cerr << outside << " scores are out of histogram range, they are counted in the edge bins." << std::endl;
+    MergeCurves(std::vector<const TOpFinder*>(groupFinders.begin(), groupFinders.end()));
+    CheckCounts();
+}
+
+void TOpFinder::ReadChunks(const std::string& inputFileName, const std::vector<TOpFinder*>& finders,
+        std::vector<TReadChunk>& chunks, TSpill& spill) {
+    //every line holds at least the actual and predicted fields with their separators
+    static const size_t MIN_LINE_SIZE = 4;
+    const TOpFinder& lead = *finders.front();
+
+    //regular files are scanned in place, stdin and pipes go through the stream
+    TMappedFile mappedFile;
+    if (!inputFileName.empty() && mappedFile.Open(inputFileName)) {
+        //with a memory limit the file is read in segments of about a run of lines each,
+        //segment size is estimated from the mean length of lines read so far
+        const char* begin = mappedFile.Begin();
+        const char* end = mappedFile.End();
+        size_t lines = 0;
+        while (true) {
+            const char* segmentEnd = end;
+            if (spill.Records) {
+                size_t lineSize = lines ? std::max((size_t)(begin - mappedFile.Begin()) / lines, MIN_LINE_SIZE) : MIN_LINE_SIZE;
+                if (spill.Records * lineSize < (size_t)(end - begin)) {
+                    const char* newLine = (const char*)memchr(begin + spill.Records * lineSize - 1, '\n',
+                                                              end - begin - spill.Records * lineSize + 1);
+                    segmentEnd = newLine ? newLine + 1 : end;
+                }
+            }
+            lead.ReadFromBuffer(begin, segmentEnd, true, finders, chunks, lines);
+            bool finished = false;
+            for (size_t i = 0; i < chunks.size(); ++i) {
+                lines += chunks[i].Lines;
+                finished = finished || chunks[i].Finished;
+            }
+            begin = segmentEnd;
+            if (finished || (begin == end))
+                break;
+            SpillRun(chunks, finders, spill);
         }
-        try {
-            actual = atoi(fields[ActualPosition].c_str());
-        } catch (...) {
-            std::cerr << "Actual class value = " << fields[ActualPosition]
-                 << " is not double. Ignoring line : " << lineCounter << std::endl;
-            continue;
+        mappedFile.Close();
+    } else {
+        std::string line;
+        std::vector<TFieldRange> fields(FieldCount(finders));
+        std::unique_ptr<std::istream> inputStream;
+        if (!inputFileName.empty()) {
+            inputStream.reset(new std::ifstream(inputFileName));
+        } else {
+            inputStream.reset(&std::cin);
         }
-        st.SetParameters(Alpha, predicted, actual);
 
-        if (FixedClass) {
-            if (st.Actual == PositiveClass) {
-                ++PC;
-                Data.push_back(st);
+        TStatsTimer timer(TStats::Parse);
+        size_t lineOffset = 0;
+        size_t bytes = 0;
+        chunks.push_back(TReadChunk(finders));
+        while (std::getline(*(inputStream.get()), line)) {
+            if (line.empty())
+                break;
+            TReadChunk& chunk = chunks.front();
+            ++chunk.Lines;
+            bytes += line.size() + 1;
+            lead.AddLine(line.data(), line.data() + line.size(), finders, fields, chunk);
+            if (!chunk.Errors.empty()) {
+                ReportErrors(chunk, lineOffset);
+                chunk.Errors.clear();
             }
-            else if (st.Actual == NegativeClass) {
-                ++NC;
-                Data.push_back(st);
+            if (spill.Records && (chunk.Lines >= spill.Records)) {
+                lineOffset += chunk.Lines;
+                CountChunk(chunk, bytes);
+                bytes = 0;
+                SpillRun(chunks, finders, spill);
+                chunks.push_back(TReadChunk(finders));
             }
-        } else {
-            if (st.Actual > PositiveClass) {
-                ++PC;
-                Data.push_back(st);
+        }
+        CountChunk(chunks.front(), bytes);
+        if (inputFileName.empty())
+            inputStream.release();
+    }
+}
+
+//Records are moved group by group into exactly sized columns, chunk ids of groups are
+//mapped to ids of keys in sorted order first
+void TOpFinder::SplitGroups(std::vector<TReadChunk>& chunks, std::vector<std::string>& keys,
+        std::vector<TOpFinder>& groups) const {
+    static const size_t TRIM_SIZE = 1 << 21;
+    std::map<std::string, uint32_t> ids;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        for (size_t j = 0; j < chunks[i].Keys.size(); ++j)
+            ids.insert(std::make_pair(chunks[i].Keys[j], 0));
+    }
+    keys.clear();
+    for (std::map<std::string, uint32_t>::iterator it = ids.begin(); it != ids.end(); ++it) {
+        it->second = keys.size();
+        keys.push_back(it->first);
+    }
+
+    TOpFinder prototype(*this);
+    prototype.Curve.Clear();
+    prototype.Grouped = false;
+    groups.assign(keys.size(), prototype);
+
+    std::vector<std::vector<uint32_t> > remap(chunks.size());
+    std::vector<size_t> positives(keys.size(), 0);
+    std::vector<size_t> negatives(keys.size(), 0);
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        for (size_t j = 0; j < chunks[i].Keys.size(); ++j)
+            remap[i].push_back(ids[chunks[i].Keys[j]]);
+        const TReadColumn& column = chunks[i].Columns.front();
+        for (std::deque<uint32_t>::const_iterator it = column.PositiveGroups.begin(); it != column.PositiveGroups.end(); ++it)
+            ++positives[remap[i][*it]];
+        for (std::deque<uint32_t>::const_iterator it = column.NegativeGroups.begin(); it != column.NegativeGroups.end(); ++it)
+            ++negatives[remap[i][*it]];
+    }
+    for (size_t i = 0; (i < groups.size()) && !Histogram.Size(); ++i) {
+        groups[i].Data.Positives.reserve(positives[i]);
+        groups[i].Data.Negatives.reserve(negatives[i]);
+        if (Weighted) {
+            groups[i].Data.PositiveWeights.reserve(positives[i]);
+            groups[i].Data.NegativeWeights.reserve(negatives[i]);
+        }
+    }
+
+    size_t moved = 0;
+    auto move = [&](std::deque<double>& scores, std::deque<double>& weights, std::deque<uint32_t>& groupIds,
+                    const std::vector<uint32_t>& chunkRemap, bool positive) {
+        while (!scores.empty()) {
+            TOpFinder& group = groups[chunkRemap[groupIds.front()]];
+            double weight = Weighted ? weights.front() : 1.0;
+            if (group.Histogram.Size()) {
+                group.Histogram.Add(scores.front(), positive, weight);
             } else {
-                ++NC;
-                Data.push_back(st);
+                (positive ? group.Data.Positives : group.Data.Negatives).push_back(scores.front());
+                if (Weighted)
+                    (positive ? group.Data.PositiveWeights : group.Data.NegativeWeights).push_back(weight);
             }
+            scores.pop_front();
+            groupIds.pop_front();
+            if (Weighted)
+                weights.pop_front();
+            if (!(++moved % TRIM_SIZE))
+                malloc_trim(0);
+        }
+    };
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        TReadColumn& column = chunks[i].Columns.front();
+        move(column.Positives, column.PositiveWeights, column.PositiveGroups, remap[i], true);
+        move(column.Negatives, column.NegativeWeights, column.NegativeGroups, remap[i], false);
+    }
+    chunks.clear();
+    malloc_trim(0);
+}
+
+//Columns are sorted in parallel, every one in a single thread if there are enough of them
+void TOpFinder::FinishColumns(const std::vector<TOpFinder*>& finders) {
+    if (finders.empty())
+        return;
+    const TOpFinder& lead = *finders.front();
+    size_t sortThreads = (finders.size() >= lead.ThreadCount) ? 1 : lead.ThreadCount;
+    TThreadPool pool(std::min(lead.ThreadCount, finders.size()));
+    for (size_t i = 0; i < finders.size(); ++i)
+        pool.Add(std::bind(&TOpFinder::FinishColumn, finders[i], sortThreads));
+    pool.Wait();
+}
+
+//Exact columns are turned into curves and written as runs, histograms keep counting
+void TOpFinder::SpillRun(std::vector<TReadChunk>& chunks, const std::vector<TOpFinder*>& finders, TSpill& spill) {
+    MergeChunks(chunks, finders);
+    chunks.clear();
+    std::vector<TOpFinder*> exact;
+    for (size_t i = 0; i < finders.size(); ++i) {
+        if (!finders[i]->Histogram.Size())
+            exact.push_back(finders[i]);
+    }
+    FinishColumns(exact);
+    for (size_t i = 0; i < finders.size(); ++i) {
+        if (!finders[i]->Histogram.Size()) {
+            spill.Write(*finders[i], i);
+            finders[i]->Curve.Clear();
+        }
+    }
+}
+
+void TOpFinder::FinishReading(std::vector<TReadChunk>& chunks, const std::vector<TOpFinder*>& finders, TSpill* spill) {
+    const TOpFinder& lead = *finders.front();
+    MergeChunks(chunks, finders);
+    FinishColumns(finders);
+    if (spill)
+        spill->Merge(finders);
+    for (size_t i = 0; i < finders.size(); ++i)
+        TStats::Add(TStats::DistinctThresholds, finders[i]->Curve.Size());
+    for (size_t i = 0; i < finders.size(); ++i) {
+        if (finders[i]->Histogram.Outside)
+            std::cerr << finders[i]->Histogram.Outside << " scores are out of histogram range, they are counted in the edge bins." << std::endl;
+    }
+    lead.CheckCounts();
+}
+
+void TOpFinder::FinishColumn(size_t sortThreads) {
+    if (Histogram.Size()) {
+        PC = std::accumulate(Histogram.Positives.begin(), Histogram.Positives.end(), 0.0);
+        NC = std::accumulate(Histogram.Negatives.begin(), Histogram.Negatives.end(), 0.0);
+    } else if (Weighted) {
+        TStatsTimer timer(TStats::Sort);
+        PC = std::accumulate(Data.PositiveWeights.begin(), Data.PositiveWeights.end(), 0.0);
+        NC = std::accumulate(Data.NegativeWeights.begin(), Data.NegativeWeights.end(), 0.0);
+        SortScores(Data.Positives, Data.PositiveWeights, sortThreads);
+        SortScores(Data.Negatives, Data.NegativeWeights, sortThreads);
+    } else {
+        TStatsTimer timer(TStats::Sort);
+        PC = Data.Positives.size();
+        NC = Data.Negatives.size();
+        SortScores(Data.Positives, sortThreads);
+        SortScores(Data.Negatives, sortThreads);
+    }
+    //from now on everything works with distinct thresholds only
+    TStatsTimer timer(TStats::Curve);
+    Binned = Histogram.Size() > 0;
+    if (Binned)
+        BuildHistogramCurve();
+    else
+        BuildCurve();
+    Data.Clear();
+}
+
+void TOpFinder::ReadFromPartials(const std::vector<std::string>& fileNames) {
+    TStatsTimer timer(TStats::Merge);
+    Data.Clear();
+    MergePartials(fileNames, Curve, PC, NC, Histogram, Binned);
+    TStats::Add(TStats::DistinctThresholds, Curve.Size());
+    CheckCounts();
+}
+
+void TOpFinder::ReadFromOnline(const TOnlineCurve& online) {
+    Data.Clear();
+    Histogram = online.GetHistogram();
+    PC = online.GetPositiveCount();
+    NC = online.GetNegativeCount();
+    Binned = true;
+    BuildHistogramCurve();
+}
+
+void TOpFinder::UpdateOnline(TOnlineCurve& online, bool remove) const {
+    double positives, negatives;
+    //removal is checked in advance, so that it fails without changing the online curve
+    if (remove) {
+        TOpFinderHistogram removed = online.GetHistogram();
+        removed.Clear();
+        for (size_t i = 0; i < Curve.Size(); ++i) {
+            GetRun(i, positives, negatives);
+            removed.Add(Curve.Thresholds[i], true, positives);
+            removed.Add(Curve.Thresholds[i], false, negatives);
+        }
+        const TOpFinderHistogram& histogram = online.GetHistogram();
+        for (size_t i = 0; i < histogram.Size(); ++i) {
+            if ((removed.Positives[i] > histogram.Positives[i] + TOpCounter::EPS)
+                    || (removed.Negatives[i] > histogram.Negatives[i] + TOpCounter::EPS))
+                throw std::runtime_error("Removed records haven't been added to the online curve.");
+        }
+    }
+    for (size_t i = 0; i < Curve.Size(); ++i) {
+        GetRun(i, positives, negatives);
+        if (remove) {
+            if (positives)
+                online.Remove(Curve.Thresholds[i], true, positives);
+            if (negatives)
+                online.Remove(Curve.Thresholds[i], false, negatives);
+        } else {
+            if (positives)
+                online.Add(Curve.Thresholds[i], true, positives);
+            if (negatives)
+                online.Add(Curve.Thresholds[i], false, negatives);
+        }
+    }
+}
+
+void TOpFinder::MergeCurves(const std::vector<const TOpFinder*>& finders) {
+    typedef std::pair<double, size_t> TPosition;    //threshold and finder
+    std::priority_queue<TPosition, std::vector<TPosition>, std::greater<TPosition> > queue;
+    std::vector<size_t> positions(finders.size(), 0);
+    TStatsTimer timer(TStats::Merge);
+    Data.Clear();
+    Curve.Clear();
+    PC = 0;
+    NC = 0;
+    Binned = false;
+    for (size_t i = 0; i < finders.size(); ++i) {
+        if (finders[i]->Curve.Size())
+            queue.push(TPosition(finders[i]->Curve.Thresholds.front(), i));
+        Binned = Binned || finders[i]->Binned;
+    }
+
+    double positives, negatives;
+    while (!queue.empty()) {
+        double thr = queue.top().first;
+        Curve.Thresholds.push_back(thr);
+        Curve.PositivePassed.push_back(PC);
+        Curve.NegativePassed.push_back(NC);
+        while (!queue.empty() && (queue.top().first == thr)) {
+            size_t i = queue.top().second;
+            queue.pop();
+            finders[i]->GetRun(positions[i], positives, negatives);
+            PC += positives;
+            NC += negatives;
+            if (++positions[i] < finders[i]->Curve.Size())
+                queue.push(TPosition(finders[i]->Curve.Thresholds[positions[i]], i));
         }
     }
-    if (inputFileName.empty())
-        inputStream.release();
-    if (Data.size()) {
-        std::sort(Data.begin(), Data.end());
+}
+
+void TOpFinder::WritePartialToFile(const std::string& fileName) const {
+    TStatsTimer timer(TStats::Output);
+    WritePartial(fileName, Curve, PC, NC, Binned ? &Histogram : nullptr);
+}
+
+bool TOpFinder::ReadFromCache(const std::string& inputFileName, const std::string& cacheFileName) {
+    TSourceFingerprint source;
+    if (!GetFingerprint(inputFileName, GetParameters(), source)
+            || !ReadCachedPartial(cacheFileName, source, Curve, PC, NC, Histogram, Binned))
+        return false;
+    TStats::Add(TStats::DistinctThresholds, Curve.Size());
+    Data.Clear();
+    CheckCounts();
+    return true;
+}
+
+void TOpFinder::WriteCacheToFile(const std::string& inputFileName, const std::string& cacheFileName) const {
+    TSourceFingerprint source;
+    if (GetFingerprint(inputFileName, GetParameters(), source))
+        WritePartial(cacheFileName, Curve, PC, NC, Binned ? &Histogram : nullptr, &source);
+}
+
+std::string TOpFinder::GetParameters() const {
+    std::ostringstream out;
+    out.precision(17);
+    out << ActualPosition << ' ' << PredictedPosition << ' ' << FixedClass << ' '
+        << PositiveClass << ' ' << NegativeClass;
+    if (Weighted)
+        out << " w" << WeightPosition;
+    if (OneVsRest)
+        out << " ovr";
+    if (Histogram.Size())
+        out << ' ' << Histogram.Size() << ' ' << Histogram.Min << ' ' << Histogram.Max;
+    return out.str();
+}
+
+void TOpFinder::CheckCounts() const {
+    if (PC + NC) {
         if (!PC)
             std::cerr << "All found records are in set of negative classes. Results may be inaccurate!" << std::endl;
         if (!NC)
@@ -110,130 +612,840 @@ void TOpFinder::ReadFromStream(const std::string& inputFileName) {
              << "No results are going to be calculated." << std::endl;
 }
 
+TOpFinder::TSpill::TSpill(const std::vector<TOpFinder*>& finders)
+    : Records(0)
+    , Runs(finders.size())
+{
+    //peak memory per record of an exact column is taken by sorting or by building the curve
+    static const size_t RECORD_SIZE = 32;
+    static const size_t WEIGHTED_RECORD_SIZE = 48;
+    const TOpFinder& lead = *finders.front();
+    if (lead.Grouped)
+        return;
+    size_t exact = 0;
+    for (size_t i = 0; i < finders.size(); ++i)
+        exact += !finders[i]->Histogram.Size();
+    if (!lead.MemoryLimit || !exact)
+        return;
+    Records = std::max(lead.MemoryLimit / (exact * (lead.Weighted ? WEIGHTED_RECORD_SIZE : RECORD_SIZE)), (size_t)1);
+    Directory = lead.TempDirectory;
+    if (Directory.empty())
+        Directory = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+}
+
+TOpFinder::TSpill::~TSpill() {
+    for (size_t i = 0; i < Runs.size(); ++i) {
+        for (size_t j = 0; j < Runs[i].size(); ++j)
+            unlink(Runs[i][j].c_str());
+    }
+}
+
+void TOpFinder::TSpill::Write(const TOpFinder& finder, size_t column) {
+    std::string fileName = Directory + "/otf-run-XXXXXX";
+    int fd = mkstemp(&fileName[0]);
+    if (fd < 0)
+        throw std::runtime_error("Can't create temporary file in " + Directory);
+    close(fd);
+    Runs[column].push_back(fileName);
+    WritePartial(fileName, finder.Curve, finder.PC, finder.NC, finder.Binned ? &finder.Histogram : nullptr);
+}
+
+//The last run is still in memory, it is written as well to be merged with the others
+void TOpFinder::TSpill::Merge(const std::vector<TOpFinder*>& finders) {
+    if (!Records)
+        return;
+    TStatsTimer timer(TStats::Merge);
+    for (size_t i = 0; i < finders.size(); ++i) {
+        if (Runs[i].empty())
+            continue;
+        TOpFinder& finder = *finders[i];
+        Write(finder, i);
+        MergePartials(Runs[i], finder.Curve, finder.PC, finder.NC, finder.Histogram, finder.Binned);
+    }
+}
+
+size_t TOpFinder::FieldCount(const std::vector<TOpFinder*>& finders) {
+    size_t last = finders.front()->ActualPosition;
+    if (finders.front()->Weighted)
+        last = std::max(last, finders.front()->WeightPosition);
+    if (finders.front()->Grouped)
+        last = std::max(last, finders.front()->GroupPosition);
+    for (size_t i = 0; i < finders.size(); ++i)
+        last = std::max(last, finders[i]->PredictedPosition);
+    return last + 1;
+}
+
+//Pages of mapped files are released as they are scanned, other buffers are left alone
+void TOpFinder::ReadFromBuffer(const char* begin, const char* end, bool mapped, const std::vector<TOpFinder*>& finders,
+        std::vector<TReadChunk>& chunks, size_t lineOffset) const {
+    static const size_t MIN_CHUNK_SIZE = 1 << 20;
+    TStatsTimer timer(TStats::Parse);
+    //a few chunks per thread to even out the load
+    size_t chunkCount = std::min(ThreadCount * 4, (size_t)(end - begin) / MIN_CHUNK_SIZE);
+    if ((ThreadCount == 1) || (chunkCount < 2))
+        chunkCount = 1;
+
+    //chunk starts are moved forward to the beginning of the next line
+    std::vector<const char*> bounds(chunkCount + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1; i < chunkCount; ++i) {
+        const char* nominal = begin + (end - begin) / chunkCount * i;
+        const char* newLine = (const char*)memchr(nominal - 1, '\n', end - nominal + 1);
+        bounds[i] = newLine ? std::max(newLine + 1, bounds[i - 1]) : end;
+    }
+
+    chunks.assign(chunkCount, TReadChunk(finders));
+    {
+        TThreadPool pool(std::min(ThreadCount, chunkCount));
+        for (size_t i = 0; i < chunkCount; ++i)
+            pool.Add(std::bind(&TOpFinder::ReadChunk, this, bounds[i], bounds[i + 1], mapped, std::cref(finders), std::ref(chunks[i])));
+        pool.Wait();
+    }
+
+    //line numbers are known only now, chunks after the first empty line are ignored
+    for (size_t i = 0; i < chunkCount; ++i) {
+        ReportErrors(chunks[i], lineOffset);
+        lineOffset += chunks[i].Lines;
+        CountChunk(chunks[i], (i + 1 < chunkCount) ? bounds[i + 1] - bounds[i] : end - bounds[i]);
+        if (chunks[i].Finished) {
+            chunks.erase(chunks.begin() + i + 1, chunks.end());
+            break;
+        }
+    }
+}
+
+void TOpFinder::CountChunk(const TReadChunk& chunk, size_t bytes) {
+    TStats::Add(TStats::LinesRead, chunk.Lines);
+    TStats::Add(TStats::BytesParsed, bytes);
+    TStats::Add(TStats::RecordsKept, chunk.Records);
+}
+
+void TOpFinder::ReadChunk(const char* begin, const char* end, bool mapped, const std::vector<TOpFinder*>& finders,
+        TReadChunk& chunk) const {
+    static const size_t RELEASE_SIZE = 16 << 20;
+    std::vector<TFieldRange> fields(FieldCount(finders));
+    const char* released = begin;
+    while (begin != end) {
+        if (mapped && ((size_t)(begin - released) >= RELEASE_SIZE)) {
+            TMappedFile::Release(released, begin);
+            released = begin;
+        }
+        const char* lineEnd = (const char*)memchr(begin, '\n', end - begin);
+        if (!lineEnd)
+            lineEnd = end;
+        if (lineEnd == begin) {
+            chunk.Finished = true;
+            break;
+        }
+        ++chunk.Lines;
+        AddLine(begin, lineEnd, finders, fields, chunk);
+        begin = (lineEnd == end) ? end : lineEnd + 1;
+    }
+    if (mapped)
+        TMappedFile::Release(released, begin);
+}
+
+void TOpFinder::AddLine(const char* begin, const char* end, const std::vector<TOpFinder*>& finders,
+        std::vector<TFieldRange>& fields, TReadChunk& chunk) const {
+    size_t fieldCount = SplitFields(begin, end, '\t', fields.data(), fields.size());
+    for (size_t i = 0; i < finders.size(); ++i) {
+        if (finders[i]->PredictedPosition >= fieldCount) {
+            chunk.Errors.push_back(TLineError("Predicted class column doesn't exist in line ", chunk.Lines, begin, end));
+            return;
+        }
+    }
+    if (ActualPosition >= fieldCount) {
+        chunk.Errors.push_back(TLineError("Actual class column doesn't exist in line ", chunk.Lines, begin, end));
+        return;
+    }
+    if (Grouped && (GroupPosition >= fieldCount)) {
+        chunk.Errors.push_back(TLineError("Group column doesn't exist in line ", chunk.Lines, begin, end));
+        return;
+    }
+    int actual;
+    ParseInt(fields[ActualPosition].Begin, fields[ActualPosition].End, actual);
+    double weight = 1.0;
+    if (Weighted) {
+        if (WeightPosition >= fieldCount) {
+            chunk.Errors.push_back(TLineError("Weight column doesn't exist in line ", chunk.Lines, begin, end));
+            return;
+        }
+        ParseDouble(fields[WeightPosition].Begin, fields[WeightPosition].End, weight);
+        if (!(weight >= 0) || isinf(weight)) {
+            chunk.Errors.push_back(TLineError("Invalid weight in line ", chunk.Lines, begin, end));
+            return;
+        }
+        //records of zero weight don't exist as far as metrics are concerned
+        if (weight == 0)
+            return;
+    }
+
+    //lines of other classes are skipped before their scores are even parsed
+    bool positive = false;
+    if (!OneVsRest) {
+        if (!FixedClass)
+            positive = actual > PositiveClass;
+        else if (actual == PositiveClass)
+            positive = true;
+        else if (actual != NegativeClass)
+            return;
+    }
+
+    //NaN has no place among sorted thresholds, the whole line is rejected
+    for (size_t i = 0; i < finders.size(); ++i) {
+        const TFieldRange& field = fields[finders[i]->PredictedPosition];
+        ParseDouble(field.Begin, field.End, chunk.Scores[i]);
+        if (!isfinite(chunk.Scores[i])) {
+            chunk.Errors.push_back(TLineError("Invalid predicted score in line ", chunk.Lines, begin, end));
+            return;
+        }
+    }
+
+    if (OneVsRest) {
+        //every finder has its own positive class, the line is parsed once for all of them
+        for (size_t i = 0; i < finders.size(); ++i)
+            chunk.Columns[i].Add(chunk.Scores[i], actual == finders[i]->PositiveClass, weight);
+    } else {
+        uint32_t group = Grouped ? chunk.GetGroup(fields[GroupPosition].Begin, fields[GroupPosition].End) : 0;
+        for (size_t i = 0; i < finders.size(); ++i)
+            chunk.Columns[i].Add(chunk.Scores[i], positive, weight, group);
+    }
+    ++chunk.Records;
+}
+
+void TOpFinder::ReportErrors(const TReadChunk& chunk, size_t lineOffset) {
+    TStats::Add(TStats::LinesRejected, chunk.Errors.size());
+    for (size_t i = 0; i < chunk.Errors.size(); ++i) {
+        const TLineError& error = chunk.Errors[i];
+        std::cerr << error.Message << lineOffset + error.Line << " : " << error.Text << std::endl;
+    }
+}
+
+//Moves data of the chunks into exactly sized columns. Freed deque blocks are returned
+//to the system on the way, otherwise peak memory would be twice the data size.
+static void MoveColumn(std::deque<double>& source, std::vector<double>& destination) {
+    static const size_t TRIM_SIZE = 1 << 21;
+    while (!source.empty()) {
+        destination.push_back(source.front());
+        source.pop_front();
+        if (!(destination.size() % TRIM_SIZE))
+            malloc_trim(0);
+    }
+    std::deque<double>().swap(source);
+    malloc_trim(0);
+}
+
+void TOpFinder::MergeChunks(std::vector<TReadChunk>& chunks, const std::vector<TOpFinder*>& finders) {
+    for (size_t column = 0; column < finders.size(); ++column) {
+        TOpFinder& finder = *finders[column];
+        size_t positives = 0;
+        size_t negatives = 0;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            positives += chunks[i].Columns[column].Positives.size();
+            negatives += chunks[i].Columns[column].Negatives.size();
+        }
+        finder.Data.Positives.reserve(positives);
+        finder.Data.Negatives.reserve(negatives);
+        if (finders.front()->Weighted) {
+            finder.Data.PositiveWeights.reserve(positives);
+            finder.Data.NegativeWeights.reserve(negatives);
+        }
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            MoveColumn(chunks[i].Columns[column].Positives, finder.Data.Positives);
+            MoveColumn(chunks[i].Columns[column].Negatives, finder.Data.Negatives);
+            MoveColumn(chunks[i].Columns[column].PositiveWeights, finder.Data.PositiveWeights);
+            MoveColumn(chunks[i].Columns[column].NegativeWeights, finder.Data.NegativeWeights);
+            finder.Histogram.Merge(chunks[i].Columns[column].Histogram);
+        }
+    }
+}
+
+void TOpFinder::CalculateBlock(const TOpFinderCurve& curve, double pc, double nc, size_t begin, size_t size,
+        TMetricKernel& kernel) const {
+    kernel.Calculate(curve.Thresholds.data() + begin, curve.PositivePassed.data() + begin,
+                     curve.NegativePassed.data() + begin, size, pc, nc, Alpha);
+}
+
+void TOpFinder::CalculateCounter(size_t point, TOpCounter& counter) const {
+    CalculateCounter(Curve, PC, NC, point, counter);
+}
+
+void TOpFinder::CalculateCounter(const TOpFinderCurve& curve, double pc, double nc, size_t point, TOpCounter& counter) const {
+    counter.SetParameters(Alpha, curve.Thresholds[point], 0);
+    counter.Calculate(curve.PositivePassed[point], pc, curve.NegativePassed[point], nc);
+}
+
+void TOpFinder::BuildCurve() {
+    Curve.Clear();
+    const std::vector<double>& positives = Data.Positives;
+    const std::vector<double>& negatives = Data.Negatives;
+    const double* positiveWeights = Weighted ? Data.PositiveWeights.data() : nullptr;
+    const double* negativeWeights = Weighted ? Data.NegativeWeights.data() : nullptr;
+    size_t p = 0;
+    size_t n = 0;
+    double pc = 0;
+    double nc = 0;
+    while ((p < positives.size()) || (n < negatives.size())) {
+        double thr;
+        if (n == negatives.size())
+            thr = positives[p];
+        else if (p == positives.size())
+            thr = negatives[n];
+        else
+            thr = std::min(positives[p], negatives[n]);
+        Curve.Thresholds.push_back(thr);
+        Curve.PositivePassed.push_back(pc);
+        Curve.NegativePassed.push_back(nc);
+        size_t runP = p;
+        size_t runN = n;
+        for (; (p < positives.size()) && (positives[p] == thr); ++p)
+            pc += positiveWeights ? positiveWeights[p] : 1.0;
+        for (; (n < negatives.size()) && (negatives[n] == thr); ++n)
+            nc += negativeWeights ? negativeWeights[n] : 1.0;
+        if (Weighted) {
+            Curve.PositiveRecords.push_back((double)(p - runP));
+            Curve.NegativeRecords.push_back((double)(n - runN));
+        }
+    }
+}
+
+void TOpFinder::BuildHistogramCurve() {
+    Curve.Clear();
+    double pc = 0;
+    double nc = 0;
+    for (size_t i = 0; i < Histogram.Size(); ++i) {
+        if (!Histogram.Positives[i] && !Histogram.Negatives[i])
+            continue;
+        Curve.Thresholds.push_back(Histogram.Threshold(i));
+        Curve.PositivePassed.push_back(pc);
+        Curve.NegativePassed.push_back(nc);
+        pc += Histogram.Positives[i];
+        nc += Histogram.Negatives[i];
+    }
+}
+
+void TOpFinder::GetRun(size_t point, double& positives, double& negatives) const {
+    if (point + 1 < Curve.Size()) {
+        positives = Curve.PositivePassed[point + 1] - Curve.PositivePassed[point];
+        negatives = Curve.NegativePassed[point + 1] - Curve.NegativePassed[point];
+    } else {
+        positives = PC - Curve.PositivePassed[point];
+        negatives = NC - Curve.NegativePassed[point];
+    }
+}
+
 void TOpFinder::Calculate() {
-    size_t pc = 0;
-    size_t nc = 0;
-    Results.AUC = 0;
-    for (size_t i = 0; i < Data.size(); ++i) {
-        try {
-            Data[i].Calculate(pc, PC, nc, NC);
-        }
-        catch (...) {
-            std::cerr << "Something happened" << std::endl;
-        }
-        if (FixedClass) {
-            if (Data[i].Actual == PositiveClass)
-                ++pc;
-            else
-                ++nc;
-        } else {
-            if (Data[i].Actual > PositiveClass)
-                ++pc;
-            else
-                ++nc;
+    TStatsTimer timer(TStats::Calculate);
+    //records sharing a bin are taken for ties, which can't be wrong by more than half of their pairs
+    Results.AUCError = 0;
+    if (Binned && PC && NC) {
+        double positives, negatives;
+        for (size_t i = 0; i < Curve.Size(); ++i) {
+            GetRun(i, positives, negatives);
+            Results.AUCError += positives * negatives;
         }
-        if (i) {
-            Results.AUC += (Data[i - 1].GetValue(TOpCounter::FPR) - Data[i].GetValue(TOpCounter::FPR)) *
-                            (Data[i].GetValue(TOpCounter::TPR) + Data[i - 1].GetValue(TOpCounter::TPR)) / 2.0;
+        Results.AUCError /= 2.0 * PC * NC;
+    }
+
+    Results.AUC = CalculateAUC(Curve, PC, NC, &Results.PRAUC, &Results.AveragePrecision);
+}
+
+//Integral of precision over true positives between points (tpA, fpA) and (tpB, fpB), tpA <= tpB.
+//False positives grow linearly with true positives in between, so precision isn't linear.
+static double PrecisionIntegral(double tpA, double fpA, double tpB, double fpB) {
+    double width = tpB - tpA;
+    if (!(width > 0))
+        return 0;
+    double slope = 1.0 + (fpB - fpA) / width;
+    double base = tpA + fpA;
+    if (!(base > 0))
+        return width / slope;
+    //integral of (tpA + x) / (base + slope * x) over [0; width]
+    return width / slope + (tpA - base / slope) / slope * log1p(slope * width / base);
+}
+
+double TOpFinder::CalculateAUC(const TOpFinderCurve& curve, double pc, double nc,
+        double* prAUC, double* averagePrecision) const {
+    std::vector<TOpCounter::FieldOffset> fields(1, TOpCounter::FPR);
+    fields.push_back(TOpCounter::TPR);
+    TMetricKernel kernel(fields);
+    double auc = 0;
+    double precisionArea = 0;
+    double precisionSum = 0;
+    double tp = 0, fp = 0, previousTp = 0, previousFp = 0;
+    double fpr = 0, tpr = 0, previousFpr = 0, previousTpr = 0;
+    for (size_t begin = 0; begin < curve.Size(); begin += kernel.BlockSize()) {
+        size_t size = std::min(kernel.BlockSize(), curve.Size() - begin);
+        CalculateBlock(curve, pc, nc, begin, size, kernel);
+        for (size_t j = 0; j < size; ++j) {
+            size_t i = begin + j;
+            fpr = kernel.Column(TOpCounter::FPR)[j];
+            tpr = kernel.Column(TOpCounter::TPR)[j];
+            tp = pc - curve.PositivePassed[i];
+            fp = nc - curve.NegativePassed[i];
+            if (i) {
+                auc += (previousFpr - fpr) * (tpr + previousTpr) / 2.0;
+                precisionArea += PrecisionIntegral(tp, fp, previousTp, previousFp);
+                precisionSum += (previousTp - tp) * previousTp / (previousTp + previousFp);
+            }
+            previousFpr = fpr;
+            previousTpr = tpr;
+            previousTp = tp;
+            previousFp = fp;
         }
     }
+    //the curve ends in (0, 0), where nothing is classified as positive
+    if (curve.Size()) {
+        auc += fpr * tpr / 2.0;
+        precisionArea += PrecisionIntegral(0, 0, tp, fp);
+        if (tp > 0)
+            precisionSum += tp * tp / (tp + fp);
+    }
+    if (prAUC)
+        *prAUC = (pc > 0) ? precisionArea / pc : 0;
+    if (averagePrecision)
+        *averagePrecision = (pc > 0) ? precisionSum / pc : 0;
+    return auc;
 }
 
 void TOpFinder::WriteDataToFile(const std::string& fileName, const std::string& format) const {
-    std::string outString;
+    TStatsTimer timer(TStats::Output);
     std::ofstream outStream(fileName);
-    for (TOpFinderData::const_iterator i = Data.begin(); i != Data.end(); ++i) {
-        i->GetLine(format, outString);
-        outStream << outString << std::endl;
+    TOutputBuffer out(outStream);
+    TOpFormat opFormat(format);
+    TMetricKernel kernel(opFormat.GetFields());
+    for (size_t begin = 0; begin < Curve.Size(); begin += kernel.BlockSize()) {
+        size_t size = std::min(kernel.BlockSize(), Curve.Size() - begin);
+        CalculateBlock(Curve, PC, NC, begin, size, kernel);
+        for (size_t i = 0; i < size; ++i) {
+            char* line = opFormat.Write(kernel, i, out.Reserve(opFormat.MaxLength() + 1));
+            *line++ = '\n';
+            out.Commit(line);
+        }
+    }
+}
+
+//Distance from point p to segment [a; b]
+static double SegmentDistance(const TOpFinderPlot& p, const TOpFinderPlot& a, const TOpFinderPlot& b) {
+    double dx = b.XAxis - a.XAxis;
+    double dy = b.YAxis - a.YAxis;
+    double length = dx * dx + dy * dy;
+    double t = (length > 0) ? ((p.XAxis - a.XAxis) * dx + (p.YAxis - a.YAxis) * dy) / length : 0;
+    t = std::min(std::max(t, 0.0), 1.0);
+    return hypot(p.XAxis - a.XAxis - t * dx, p.YAxis - a.YAxis - t * dy);
+}
+
+//Ramer-Douglas-Peucker over curve points in threshold order, iterative so that long
+//curves don't exhaust the stack. Takes O(n log n) for curves of usual shape and O(n^2)
+//at worst. Kept points stay in curve order, reversed if x decreases along the curve,
+//since the deviation is bounded for the polyline through them in this order only.
+void TOpFinder::DecimatePlot(TOpCounter::FieldOffset xOffset, TOpCounter::FieldOffset yOffset, double deviation,
+        std::vector<TOpFinderPlot>& plot) const {
+    std::vector<TOpFinderPlot> points(Curve.Size());
+    std::vector<TOpCounter::FieldOffset> fields(1, xOffset);
+    fields.push_back(yOffset);
+    TMetricKernel kernel(fields);
+    for (size_t begin = 0; begin < Curve.Size(); begin += kernel.BlockSize()) {
+        size_t size = std::min(kernel.BlockSize(), Curve.Size() - begin);
+        CalculateBlock(Curve, PC, NC, begin, size, kernel);
+        for (size_t i = 0; i < size; ++i) {
+            points[begin + i].XAxis = kernel.Column(xOffset)[i];
+            points[begin + i].YAxis = kernel.Column(yOffset)[i];
+        }
+    }
+    plot.clear();
+    if (points.size() < 3) {
+        plot.swap(points);
+        return;
+    }
+
+    std::vector<char> kept(points.size(), 0);
+    kept.front() = kept.back() = 1;
+    std::vector<std::pair<size_t, size_t> > segments(1, std::make_pair((size_t)0, points.size() - 1));
+    while (!segments.empty()) {
+        size_t first = segments.back().first;
+        size_t last = segments.back().second;
+        segments.pop_back();
+        double farthest = 0;
+        size_t split = first;
+        for (size_t i = first + 1; i < last; ++i) {
+            double distance = SegmentDistance(points[i], points[first], points[last]);
+            if (distance > farthest) {
+                farthest = distance;
+                split = i;
+            }
+        }
+        if (farthest > deviation) {
+            kept[split] = 1;
+            segments.push_back(std::make_pair(first, split));
+            segments.push_back(std::make_pair(split, last));
+        }
     }
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (kept[i])
+            plot.push_back(points[i]);
+    }
+    bool decreasing = true;
+    for (size_t i = 1; decreasing && (i < plot.size()); ++i)
+        decreasing = plot[i].XAxis <= plot[i - 1].XAxis;
+    if (decreasing)
+        std::reverse(plot.begin(), plot.end());
 }
 
-void TOpFinder::WritePlotToFile(const std::string& fileName, const std::string& xAxis, const std::string& yAxis, size_t n) {
+void TOpFinder::WritePlotToFile(const std::string& fileName, const std::string& xAxis, const std::string& yAxis, size_t n,
+        double deviation) const {
+    std::ofstream outStream(fileName);
+    WritePlot(outStream, xAxis, yAxis, n, deviation);
+}
+
+void TOpFinder::WritePlot(std::ostream& outStream, const std::string& xAxis, const std::string& yAxis, size_t n,
+        double deviation) const {
+    TStatsTimer timer(TStats::Plot);
     TOpCounter::FieldOffset xOffset = TOpCounter::GetFieldOffset(xAxis);
     if (xOffset == TOpCounter::InvalidOffset)
         throw std::runtime_error("Invalid plot x-axis value");
     TOpCounter::FieldOffset yOffset = TOpCounter::GetFieldOffset(yAxis);
     if (yOffset == TOpCounter::InvalidOffset)
         throw std::runtime_error("Invalid plot y-axis value");
-    std::ofstream outStream(fileName);
 
-    size_t step = (size_t)((double)Data.size() / (double)n);
-    std::vector<TOpFinderPlot> plotFile(n * 2);
+    std::vector<TOpFinderPlot> plotFile;
+    if (deviation > 0) {
+        DecimatePlot(xOffset, yOffset, deviation, plotFile);
+    } else {
+        SamplePlot(xOffset, yOffset, n, plotFile);
+        std::sort(plotFile.begin(), plotFile.end());
+    }
+
+    TOutputBuffer out(outStream);
+    for (size_t i = 0; i < plotFile.size(); ++i) {
+        out.Append(plotFile[i].XAxis);
+        out.Append("\t", 1);
+        out.Append(plotFile[i].YAxis);
+        out.Append("\n", 1);
+    }
+}
+
+//Points at a fixed index stride and at a fixed threshold stride
+void TOpFinder::SamplePlot(TOpCounter::FieldOffset xOffset, TOpCounter::FieldOffset yOffset, size_t n,
+        std::vector<TOpFinderPlot>& plotFile) const {
+    size_t step = std::max((size_t)((double)Curve.Size() / (double)n), (size_t)1);
+    plotFile.assign(n * 2, TOpFinderPlot());
+    TOpCounter counter;
     size_t j = 0;
-    for (size_t i = 0; ((i < Data.size()) && (j < n)); i += step, ++j) {
-        plotFile[j].XAxis = Data[i].GetValue(xOffset);
-        plotFile[j].YAxis = Data[i].GetValue(yOffset);
-    }
-    if (Data.size()) {
-        double thrStep = (Data.back().GetValue(TOpCounter::Threshold) - Data.front().GetValue(TOpCounter::Threshold)) / (double)n;
-        double thr = Data.front().GetValue(TOpCounter::Threshold);
-        TOpFinderData::iterator it = Data.begin();
+    for (size_t i = 0; ((i < Curve.Size()) && (j < n)); i += step, ++j) {
+        CalculateCounter(i, counter);
+        plotFile[j].XAxis = counter.GetValue(xOffset);
+        plotFile[j].YAxis = counter.GetValue(yOffset);
+    }
+    if (Curve.Size()) {
+        double thrStep = (Curve.Thresholds.back() - Curve.Thresholds.front()) / (double)n;
+        double thr = Curve.Thresholds.front();
+        std::vector<double>::const_iterator it = Curve.Thresholds.begin();
         for (size_t i = 0; (i < n) && (j < n * 2); ++i, ++j) {
-            if (it != Data.end()) {
-                plotFile[j].XAxis = it->GetValue(xOffset);
-                plotFile[j].YAxis = it->GetValue(yOffset);
+            if (it != Curve.Thresholds.end()) {
+                CalculateCounter(it - Curve.Thresholds.begin(), counter);
+                plotFile[j].XAxis = counter.GetValue(xOffset);
+                plotFile[j].YAxis = counter.GetValue(yOffset);
             } else {
                 --j;
             }
             thr += thrStep;
-            FindNextThreshold(it, thr);
+            it = std::lower_bound(it, Curve.Thresholds.end(), thr);
         }
     }
 
     if (plotFile.size() > j)
         plotFile.resize(j);
-    std::sort(plotFile.begin(), plotFile.end());
+}
 
-    for (size_t i = 0; i < plotFile.size(); ++i) {
-        outStream << plotFile[i].XAxis << "\t" << plotFile[i].YAxis << std::endl;
+TOpFinder::TQuery::TQuery(const std::string& target, const std::string& argument, double argVal, double alpha)
+    : TargetName(target)
+    , ArgumentName(argument)
+    , Target(TOpCounter::GetFieldOffset(target))
+    , Argument(TOpCounter::InvalidOffset)
+    , ArgValue(argVal)
+    , Alpha(alpha)
+    , Found(false)
+    , OptimalThreshold(0)
+    , TargetValue(0)
+    , ArgumentValue(0)
+{
+    if (Target == TOpCounter::InvalidOffset)
+        throw std::runtime_error("Invalid target function value");
+    if (!argument.empty()) {
+        Argument = TOpCounter::GetFieldOffset(argument);
+        if (Argument == TOpCounter::InvalidOffset)
+            throw std::runtime_error("Invalid argument for function value");
     }
 }
 
-void TOpFinder::FindNextThreshold(TOpFinderData::iterator& i, double thr) const {
-    while ((i->GetValue(TOpCounter::Threshold) < thr) && (i != Data.end())) {
-        ++i;
-    }
+static inline double GetQueryValue(const TMetricKernel& kernel, size_t point, TOpCounter::FieldOffset offset, double alpha) {
+    if (offset != TOpCounter::Fmeasure)
+        return kernel.Column(offset)[point];
+    double precision = kernel.Column(TOpCounter::Precision)[point];
+    double recall = kernel.Column(TOpCounter::Recall)[point];
+    return 1 / (alpha / precision + (1.0 - alpha) / recall);
 }
 
 void TOpFinder::FindOptimalThreshold(const std::string& target, const std::string& argument, double argVal) {
-    TOpCounter::FieldOffset targetOffset = TOpCounter::GetFieldOffset(target);
-    if (targetOffset == TOpCounter::InvalidOffset)
-        throw std::runtime_error("Invalid target function value");
-    TOpCounter::FieldOffset argumentOffset;
-    if (!argument.empty()) {
-        argumentOffset = TOpCounter::GetFieldOffset(argument);
-        if (argumentOffset == TOpCounter::InvalidOffset)
-            throw std::runtime_error("Invalid argument for function value");
-    }
+    std::vector<TQuery> queries(1, TQuery(target, argument, argVal, Alpha));
+    FindOptimalThresholds(queries);
+    const TQuery& query = queries.front();
+    if (!query.Found)
+        throw std::runtime_error("No threshold satisfies the argument value");
 
-    TOpFinderData::iterator targetVal = Data.begin();
+    if (query.Argument != TOpCounter::InvalidOffset)
+        Results.Argument = query.ArgumentValue;
+    Results.OptimalThreshold = query.OptimalThreshold;
+    Results.Target = query.TargetValue;
+}
 
-    if (!argument.empty()) {
-        targetVal = Data.end();
-        for (TOpFinderData::iterator i = Data.begin(); i != Data.end(); ++i) {
-            if (i->GetValue(argumentOffset) >= argVal) {
-                if (targetVal == Data.end())
-                    targetVal = i;
-                else if (i->GetValue(targetOffset) > targetVal->GetValue(targetOffset))
-                    targetVal = i;
+void TOpFinder::FindOptimalThresholds(std::vector<TQuery>& queries) const {
+    TStatsTimer timer(TStats::Optimize);
+    FindOptimalThresholds(Curve, PC, NC, queries);
+}
+
+void TOpFinder::FindOptimalThresholds(const TOpFinderCurve& curve, double pc, double nc, std::vector<TQuery>& queries) const {
+    for (size_t q = 0; q < queries.size(); ++q)
+        queries[q].Found = false;
+
+    //F-measure is derived from precision and recall with every query's own alpha
+    std::vector<TOpCounter::FieldOffset> fields(1, TOpCounter::Precision);
+    fields.push_back(TOpCounter::Recall);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        fields.push_back(queries[q].Target);
+        if (queries[q].Argument != TOpCounter::InvalidOffset)
+            fields.push_back(queries[q].Argument);
+    }
+    TMetricKernel kernel(fields);
+    for (size_t begin = 0; begin < curve.Size(); begin += kernel.BlockSize()) {
+        size_t size = std::min(kernel.BlockSize(), curve.Size() - begin);
+        CalculateBlock(curve, pc, nc, begin, size, kernel);
+        for (size_t i = 0; i < size; ++i) {
+            for (size_t q = 0; q < queries.size(); ++q) {
+                TQuery& query = queries[q];
+                double argument = 0;
+                if (query.Argument != TOpCounter::InvalidOffset) {
+                    argument = GetQueryValue(kernel, i, query.Argument, query.Alpha);
+                    if (argument < query.ArgValue)
+                        continue;
+                }
+                double target = GetQueryValue(kernel, i, query.Target, query.Alpha);
+                if (!query.Found || (target > query.TargetValue)) {
+                    query.Found = true;
+                    query.OptimalThreshold = curve.Thresholds[begin + i];
+                    query.TargetValue = target;
+                    query.ArgumentValue = argument;
+                }
             }
         }
-        Results.Argument = targetVal->GetValue(argumentOffset);
-    } else {
-        for (TOpFinderData::iterator i = Data.begin(); i != Data.end(); ++i) {
-            if (i->GetValue(targetOffset) > targetVal->GetValue(targetOffset))
-                targetVal = i;
+    }
+}
+
+/*
+    1/F = alpha / P + (1 - alpha) / R is linear in alpha, so a threshold is a line over alphas and the
+    optimal ones form the lower envelope of the lines, i.e. the lower convex hull of points (1/R, 1/P).
+    Recall doesn't increase along the curve, so points come sorted by 1/R and the hull is built by a
+    single pass of monotone chain. Points which are no better in precision than an earlier one are
+    dominated, so ties are resolved to the lowest threshold as in FindOptimalThresholds. A point of
+    the same recall and better precision replaces an earlier one, except for the first point, which
+    keeps a segment of alpha = 0 alone.
+*/
+std::vector<TOpFinder::TFrontierSegment> TOpFinder::FindFmeasureFrontier() const {
+    TStatsTimer timer(TStats::Optimize);
+    struct TPoint {
+        double X;       //1 / recall
+        double Y;       //1 / precision
+        size_t Index;
+        double Precision;
+        double Recall;
+    };
+    std::vector<TPoint> hull;
+    std::vector<TOpCounter::FieldOffset> fields(1, TOpCounter::Precision);
+    fields.push_back(TOpCounter::Recall);
+    TMetricKernel kernel(fields);
+    for (size_t begin = 0; begin < Curve.Size(); begin += kernel.BlockSize()) {
+        size_t size = std::min(kernel.BlockSize(), Curve.Size() - begin);
+        CalculateBlock(Curve, PC, NC, begin, size, kernel);
+        for (size_t i = 0; i < size; ++i) {
+            double precision = kernel.Column(TOpCounter::Precision)[i];
+            double recall = kernel.Column(TOpCounter::Recall)[i];
+            if (!(precision > 0) || !(recall > 0))
+                continue;
+            TPoint point = {1.0 / recall, 1.0 / precision, begin + i, precision, recall};
+            if (!hull.empty() && (point.Y >= hull.back().Y))
+                continue;
+            //points of equal recall tie at alpha = 0 only, where the first point of the curve wins
+            while (!hull.empty() && (hull.back().X >= point.X) && (hull.size() > 1))
+                hull.pop_back();
+            while (hull.size() > 1) {
+                const TPoint& a = hull[hull.size() - 2];
+                const TPoint& b = hull.back();
+                if ((b.X - a.X) * (point.Y - a.Y) - (b.Y - a.Y) * (point.X - a.X) > 0)
+                    break;
+                hull.pop_back();
+            }
+            hull.push_back(point);
         }
     }
 
-    Results.OptimalThreshold = targetVal->GetValue(TOpCounter::Threshold);
-    Results.Target = targetVal->GetValue(targetOffset);
+    std::vector<TFrontierSegment> frontier(hull.size());
+    for (size_t i = 0; i < hull.size(); ++i) {
+        TFrontierSegment& segment = frontier[i];
+        segment.AlphaBegin = i ? frontier[i - 1].AlphaEnd : 0.0;
+        if (i + 1 < hull.size()) {
+            //alpha where 1/F of the point and of the next one are equal
+            double dx = hull[i + 1].X - hull[i].X;
+            double dy = hull[i].Y - hull[i + 1].Y;
+            segment.AlphaEnd = dx / (dx + dy);
+        } else
+            segment.AlphaEnd = 1.0;
+        segment.Threshold = Curve.Thresholds[hull[i].Index];
+        segment.Precision = hull[i].Precision;
+        segment.Recall = hull[i].Recall;
+    }
+    return frontier;
+}
+
+const TOpFinder::TFrontierSegment& TOpFinder::FindFrontierSegment(const std::vector<TFrontierSegment>& frontier, double alpha) {
+    size_t begin = 0;
+    size_t end = frontier.size() - 1;
+    while (begin < end) {
+        size_t middle = (begin + end) / 2;
+        if (frontier[middle].AlphaEnd < alpha)
+            begin = middle + 1;
+        else
+            end = middle;
+    }
+    return frontier[begin];
+}
+
+std::vector<TOpFinder::TQuery> TOpFinder::ReadQueriesFromFile(const std::string& fileName, double alpha) {
+    std::ifstream in(fileName);
+    if (!in)
+        throw std::runtime_error("Can't read queries file " + fileName);
+    return ReadQueries(in, alpha);
+}
+
+std::vector<TOpFinder::TQuery> TOpFinder::ReadQueries(std::istream& in, double alpha) {
+    std::vector<TQuery> queries;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string target, argument, argVal, queryAlpha;
+        fields >> target >> argument >> argVal >> queryAlpha;
+        if (target.empty() || (target[0] == '#'))
+            continue;
+        if (argument == "-")
+            argument.clear();
+        queries.push_back(TQuery(target, argument,
+                                 (argVal.empty() || (argVal == "-")) ? 0.95 : atof(argVal.c_str()),
+                                 (queryAlpha.empty() || (queryAlpha == "-")) ? alpha : atof(queryAlpha.c_str())));
+        if ((queries.back().Alpha < 0) || (queries.back().Alpha > 1))
+            throw std::runtime_error("Alpha should be in [0;1]");
+    }
+    return queries;
 }
 
 const TOpFinder::TResults& TOpFinder::GetResults() const {
     return Results;
 }
 
+const TOpFinder::TBootstrapResults& TOpFinder::GetBootstrapResults() const {
+    return BootstrapResults;
+}
+
+//Weight of a run of records taken Poisson(1) times each, a record of a weighted run
+//is taken for one of the mean weight of the run
+static double SampleRun(TPoissonSampler& sampler, double weight, double records) {
+    if (!(records > 0))
+        return 0;
+    return (double)sampler.Sample(records) * (weight / records);
+}
+
+//Runs nobody has been drawn from are dropped, so thresholds absent from a replicate aren't its points
+void TOpFinder::ResampleCurve(TPoissonSampler& sampler, TOpFinderCurve& curve, double& pc, double& nc) const {
+    curve.Clear();
+    pc = 0;
+    nc = 0;
+    bool counted = !Curve.PositiveRecords.empty();
+    double positives, negatives;
+    for (size_t i = 0; i < Curve.Size(); ++i) {
+        GetRun(i, positives, negatives);
+        positives = SampleRun(sampler, positives, counted ? Curve.PositiveRecords[i] : positives);
+        negatives = SampleRun(sampler, negatives, counted ? Curve.NegativeRecords[i] : negatives);
+        if (!positives && !negatives)
+            continue;
+        curve.Thresholds.push_back(Curve.Thresholds[i]);
+        curve.PositivePassed.push_back(pc);
+        curve.NegativePassed.push_back(nc);
+        pc += positives;
+        nc += negatives;
+    }
+}
+
+void TOpFinder::Bootstrap(size_t replicates, double confidence, uint64_t seed, const std::string& target,
+        const std::string& argument, double argVal) {
+    static const size_t TASKS_PER_THREAD = 8;
+    TStatsTimer timer(TStats::Bootstrap);
+    std::vector<TQuery> query;
+    if (!target.empty())
+        query.push_back(TQuery(target, argument, argVal, Alpha));
+
+    std::vector<double> auc(replicates);
+    std::vector<double> thresholds(replicates);
+    std::vector<double> targets(replicates);
+    std::vector<char> found(replicates, 0);
+    {
+        //replicates are picked by idle threads in blocks, one curve buffer per block
+        TThreadPool pool(ThreadCount);
+        size_t block = std::max(replicates / (ThreadCount * TASKS_PER_THREAD), (size_t)1);
+        for (size_t first = 0; first < replicates; first += block) {
+            size_t last = std::min(first + block, replicates);
+            pool.Add([&, first, last]() {
+                TOpFinderCurve curve;
+                std::vector<TQuery> queries(query);
+                double pc, nc;
+                for (size_t r = first; r < last; ++r) {
+                    TPoissonSampler sampler(seed, r);
+                    ResampleCurve(sampler, curve, pc, nc);
+                    auc[r] = CalculateAUC(curve, pc, nc);
+                    if (queries.empty())
+                        continue;
+                    FindOptimalThresholds(curve, pc, nc, queries);
+                    found[r] = queries.front().Found;
+                    thresholds[r] = queries.front().OptimalThreshold;
+                    targets[r] = queries.front().TargetValue;
+                }
+            });
+        }
+        pool.Wait();
+    }
+
+    //only replicates with a feasible threshold take part in its interval
+    size_t foundCount = 0;
+    for (size_t r = 0; r < replicates; ++r) {
+        if (found[r]) {
+            thresholds[foundCount] = thresholds[r];
+            targets[foundCount] = targets[r];
+            ++foundCount;
+        }
+    }
+    thresholds.resize(foundCount);
+    targets.resize(foundCount);
+
+    double lower = (1.0 - confidence) / 2.0;
+    double upper = 1.0 - lower;
+    BootstrapResults.Replicates = replicates;
+    BootstrapResults.Confidence = confidence;
+    BootstrapResults.AUC.Lower = Percentile(auc, lower);
+    BootstrapResults.AUC.Upper = Percentile(auc, upper);
+    BootstrapResults.Found = foundCount;
+    BootstrapResults.OptimalThreshold.Lower = Percentile(thresholds, lower);
+    BootstrapResults.OptimalThreshold.Upper = Percentile(thresholds, upper);
+    BootstrapResults.Target.Lower = Percentile(targets, lower);
+    BootstrapResults.Target.Upper = Percentile(targets, upper);
+}
+
 TOpFinder::~TOpFinder() {
-    Data.clear();
 }
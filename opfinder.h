@@ -1,7 +1,71 @@
 #pragma once
 #include "opcounter.h"
+#include "common.h"
+#include "bootstrap.h"
+#include "metrickernel.h"
 
-typedef std::vector<TOpCounter> TOpFinderData;
+#include <stdint.h>
+#include <deque>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+
+//Scores of positive and negative records are kept in separate columns, so class
+//labels don't take any memory. Both columns are sorted once reading is finished.
+//Weights are parallel to scores and stay empty if there is no weight column.
+struct TOpFinderData {
+    std::vector<double> Positives;
+    std::vector<double> Negatives;
+    std::vector<double> PositiveWeights;
+    std::vector<double> NegativeWeights;
+
+    size_t Size() const;
+    void Clear();
+};
+
+//Runs of equal scores collapsed into points at distinct thresholds, sorted ascending.
+//Passed counts are weights of records scored below the threshold (their numbers if
+//records aren't weighted), i.e. arguments of TOpCounter::Calculate; run sizes are
+//differences of neighbouring points. Curves of weighted records built from the records
+//keep numbers of records of every run as well, for the bootstrap to resample records.
+struct TOpFinderCurve {
+    std::vector<double> Thresholds;
+    std::vector<double> PositivePassed;
+    std::vector<double> NegativePassed;
+    std::vector<double> PositiveRecords;
+    std::vector<double> NegativeRecords;
+
+    size_t Size() const;
+    void Clear();
+};
+
+/*
+    Fixed resolution histogram of scores for the bounded memory streaming mode. Bin i
+    counts scores in [Min + i * w; Min + (i + 1) * w), w = (Max - Min) / bins; scores
+    outside of [Min; Max) are counted in the edge bins. Curve points are put at lower
+    bin edges, so every reported metric is exact for its threshold, only the choice of
+    thresholds is limited to the grid: the optimal threshold is found up to w. Scores
+    sharing a bin are treated as ties, which moves AUC by at most
+    sum(Positives[i] * Negatives[i]) / (2 * PC * NC), see TResults::AUCError.
+*/
+struct TOpFinderHistogram {
+    double Min;
+    double Max;
+    std::vector<double> Positives;
+    std::vector<double> Negatives;
+    size_t Outside;     //scores counted in the edge bins being out of range
+
+    TOpFinderHistogram();
+
+    void Reset(size_t bins, double min, double max);
+    void Clear();
+    size_t Size() const;
+    //Bin of the score, outside is set if the score is out of range
+    size_t Bin(double score, bool& outside) const;
+    void Add(double score, bool positive, double weight = 1.0);
+    void Merge(const TOpFinderHistogram& histogram);
+    double Threshold(size_t bin) const;
+};
 
 struct TOpFinderPlot {
     double XAxis;
@@ -10,6 +74,8 @@ struct TOpFinderPlot {
     bool operator<(const TOpFinderPlot& p) const;
 };
 
+class TOnlineCurve;
+
 class TOpFinder {
 public:
     struct TResults {
@@ -17,32 +83,239 @@ public:
         double Target;
         double Argument;
         double AUC;
+        double AUCError;    //upper bound of AUC error in histogram mode, 0 otherwise
+        double PRAUC;       //area under precision-recall curve, interpolated between points as in Davis & Goadrich
+        double AveragePrecision;
+    };
+
+    //Constrained optimization: max of target function over thresholds where argument >= ArgValue.
+    //Alpha is used for F-measure target or argument instead of the finder's one.
+    struct TQuery {
+        std::string TargetName;
+        std::string ArgumentName;
+        TOpCounter::FieldOffset Target;
+        TOpCounter::FieldOffset Argument;   //InvalidOffset if there is no constraint
+        double ArgValue;
+        double Alpha;
+
+        bool Found;
+        double OptimalThreshold;
+        double TargetValue;
+        double ArgumentValue;
+
+        TQuery(const std::string& target, const std::string& argument = "", double argVal = 0.95, double alpha = 0.5);
+    };
+
+    //Percentile intervals over bootstrap replicates, threshold and target ones are built
+    //from replicates where some threshold satisfies the argument value
+    struct TBootstrapResults {
+        struct TInterval {
+            double Lower;
+            double Upper;
+        };
+
+        size_t Replicates;
+        double Confidence;
+        TInterval AUC;
+        size_t Found;
+        TInterval OptimalThreshold;
+        TInterval Target;
+    };
+
+    //Point of the F-measure frontier, its threshold maximizes F-measure for alphas in [AlphaBegin; AlphaEnd]
+    struct TFrontierSegment {
+        double AlphaBegin;
+        double AlphaEnd;
+        double Threshold;
+        double Precision;
+        double Recall;
     };
 
     TOpFinder(size_t actual, size_t predicted, int positive, int negative, bool fixed = true, double alpha = 0.5);
     ~TOpFinder();
 
+    void SetThreadCount(size_t threads);
+    void SetHistogram(size_t bins, double min = 0.0, double max = 1.0);
+    //Records are weighted by the column value instead of being counted once each
+    void SetWeightColumn(size_t weight);
+    //Records of every class other than the positive one are negative
+    void SetOneVsRest();
+    //External memory mode: once parsed records would take more than the limit, they are sorted
+    //and spilled to a temporary file as a run of the curve, runs are merged after reading.
+    //Histogram columns are bounded anyway and stay in memory. Zero limit turns the mode off.
+    void SetMemoryLimit(size_t bytes, const std::string& tempDirectory = "");
+    //Group mode: records are split by the value of the group column, see ReadGroupsFromStream
+    void SetGroupColumn(size_t group);
     void ReadFromStream(const std::string& inputFileName = "");
+    //Parses input once for finders which differ in predicted column or histogram only,
+    //actual and weight columns, classes and threads count are taken from the first of them
+    static void ReadFromStream(const std::string& inputFileName, const std::vector<TOpFinder*>& finders);
+    //Parses input once putting records of every group into a finder of its own with settings of
+    //this one, groups are finished on the thread pool and sorted by key. This finder gets the
+    //curve of all records merged from the groups. Memory limit isn't applied in group mode.
+    void ReadGroupsFromStream(const std::string& inputFileName, std::vector<std::string>& keys,
+                              std::vector<TOpFinder>& groups);
+    //Reads tab separated rows from memory, e.g. received over a socket, returns
+    //the number of rejected lines, which are reported as well
+    size_t ReadFromMemory(const char* begin, const char* end);
+    void ReadFromPartials(const std::vector<std::string>& fileNames);
+    //Pools records of all finders into a single curve, e.g. for micro averaging
+    void MergeCurves(const std::vector<const TOpFinder*>& finders);
+    //Takes the curve of bins of the online curve, records aren't needed
+    void ReadFromOnline(const TOnlineCurve& online);
+    //Adds records of the curve to the online one, or removes them to slide a window
+    void UpdateOnline(TOnlineCurve& online, bool remove = false) const;
+    void WritePartialToFile(const std::string& fileName) const;
+    //Cache is a partial results file bound to the input file and reading parameters,
+    //loading fails if the input has been changed since the cache was written
+    bool ReadFromCache(const std::string& inputFileName, const std::string& cacheFileName);
+    void WriteCacheToFile(const std::string& inputFileName, const std::string& cacheFileName) const;
     void WriteDataToFile(const std::string& fileName, const std::string& format) const;
-    void WritePlotToFile(const std::string& fileName, const std::string& xAxis, const std::string& yAxis, size_t n);
+    //With positive deviation the curve is decimated instead of sampling n points: points are kept
+    //so that no dropped point is farther than deviation from the polyline through the kept ones,
+    //which are written in curve order. Not the fewest such points, see DecimatePlot.
+    void WritePlotToFile(const std::string& fileName, const std::string& xAxis, const std::string& yAxis, size_t n,
+                         double deviation = 0) const;
+    void WritePlot(std::ostream& out, const std::string& xAxis, const std::string& yAxis, size_t n,
+                   double deviation = 0) const;
     void Calculate();
     void FindOptimalThreshold(const std::string& target, const std::string& argument, double argVal = 0.95);
+    //Answers all queries in one scan of the curve
+    void FindOptimalThresholds(std::vector<TQuery>& queries) const;
+    //Resamples records with Poisson weights over the curve runs, replicates are computed on
+    //the thread pool and are the same for a given seed whatever the threads count.
+    //Weighted records need their numbers, so their curve should be built from the records.
+    void Bootstrap(size_t replicates, double confidence, uint64_t seed, const std::string& target = "",
+                   const std::string& argument = "", double argVal = 0.95);
+    //Optimal thresholds of F-measure for all alphas in [0;1] in one scan of the curve, segments are
+    //ordered by alpha. Empty if no threshold passes positive records.
+    std::vector<TFrontierSegment> FindFmeasureFrontier() const;
+    //Segment of a non-empty frontier containing the alpha, the lower threshold at a boundary
+    static const TFrontierSegment& FindFrontierSegment(const std::vector<TFrontierSegment>& frontier, double alpha);
+    //Reads queries one per line: target [argument argval [alpha]], "-" skips a field
+    static std::vector<TQuery> ReadQueriesFromFile(const std::string& fileName, double alpha);
+    static std::vector<TQuery> ReadQueries(std::istream& in, double alpha);
 
     const TResults& GetResults() const;
+    const TBootstrapResults& GetBootstrapResults() const;
 
 private:
     TOpFinderData Data;
+    TOpFinderCurve Curve;
+    TOpFinderHistogram Histogram;
+
+    struct TLineError {
+        const char* Message;
+        size_t Line;
+        std::string Text;
+
+        TLineError(const char* message, size_t line, const char* begin, const char* end)
+            : Message(message), Line(line), Text(begin, end) {}
+    };
+
+    //Scores of a single predicted column, in histogram mode they are counted in
+    //column's own histogram. Deques grow without reallocation, so parsing doesn't
+    //need twice the memory. In group mode scores are kept exact together with ids
+    //of their groups, they are binned once split into groups.
+    struct TReadColumn {
+        std::deque<double> Positives;
+        std::deque<double> Negatives;
+        std::deque<double> PositiveWeights;
+        std::deque<double> NegativeWeights;
+        std::deque<uint32_t> PositiveGroups;
+        std::deque<uint32_t> NegativeGroups;
+        TOpFinderHistogram Histogram;
+        bool Weighted;
+        bool Grouped;
+
+        TReadColumn(const TOpFinderHistogram& histogram, bool weighted, bool grouped)
+            : Histogram(histogram), Weighted(weighted), Grouped(grouped) {}
+        void Add(double score, bool positive, double weight, uint32_t group = 0);
+    };
+
+    //Part of the input parsed independently, line numbers are relative to chunk start
+    struct TReadChunk {
+        std::vector<TReadColumn> Columns;   //one per finder
+        size_t Lines;
+        size_t Records;     //lines of positive or negative records
+        bool Finished;      //empty line has been met
+        std::vector<TLineError> Errors;
+        std::vector<std::string> Keys;      //group keys by ids local to the chunk
+        std::unordered_map<std::string, uint32_t> KeyIds;
+        std::string Key;
+        std::vector<double> Scores;         //predicted scores of the current line, one per finder
+
+        explicit TReadChunk(const std::vector<TOpFinder*>& finders);
+        uint32_t GetGroup(const char* begin, const char* end);
+    };
+
+    //Curve runs spilled to temporary partial files, they are removed by the destructor
+    struct TSpill {
+        size_t Records;     //records of a run, zero if nothing is spilled
+        std::string Directory;
+        std::vector<std::vector<std::string> > Runs;    //file names per finder
+
+        explicit TSpill(const std::vector<TOpFinder*>& finders);
+        ~TSpill();
+        void Write(const TOpFinder& finder, size_t column);
+        void Merge(const std::vector<TOpFinder*>& finders);
+    };
 
-    void FindNextThreshold(TOpFinderData::iterator& i, double thr) const;
+    static size_t FieldCount(const std::vector<TOpFinder*>& finders);
+    static void StartReading(const std::vector<TOpFinder*>& finders);
+    static void ReadChunks(const std::string& inputFileName, const std::vector<TOpFinder*>& finders,
+                           std::vector<TReadChunk>& chunks, TSpill& spill);
+    void SplitGroups(std::vector<TReadChunk>& chunks, std::vector<std::string>& keys, std::vector<TOpFinder>& groups) const;
+    void ReadFromBuffer(const char* begin, const char* end, bool mapped, const std::vector<TOpFinder*>& finders,
+                        std::vector<TReadChunk>& chunks, size_t lineOffset = 0) const;
+    void ReadChunk(const char* begin, const char* end, bool mapped, const std::vector<TOpFinder*>& finders,
+                   TReadChunk& chunk) const;
+    void AddLine(const char* begin, const char* end, const std::vector<TOpFinder*>& finders,
+                 std::vector<TFieldRange>& fields, TReadChunk& chunk) const;
+    static void ReportErrors(const TReadChunk& chunk, size_t lineOffset);
+    static void CountChunk(const TReadChunk& chunk, size_t bytes);
+    static void MergeChunks(std::vector<TReadChunk>& chunks, const std::vector<TOpFinder*>& finders);
+    static void FinishColumns(const std::vector<TOpFinder*>& finders);
+    static void SpillRun(std::vector<TReadChunk>& chunks, const std::vector<TOpFinder*>& finders, TSpill& spill);
+    static void FinishReading(std::vector<TReadChunk>& chunks, const std::vector<TOpFinder*>& finders,
+                              TSpill* spill = nullptr);
+    void FinishColumn(size_t sortThreads);
+    void BuildCurve();
+    void BuildHistogramCurve();
+    void CheckCounts() const;
+    std::string GetParameters() const;
+    void GetRun(size_t point, double& positives, double& negatives) const;
+    void SamplePlot(TOpCounter::FieldOffset xOffset, TOpCounter::FieldOffset yOffset, size_t n,
+                    std::vector<TOpFinderPlot>& plot) const;
+    void DecimatePlot(TOpCounter::FieldOffset xOffset, TOpCounter::FieldOffset yOffset, double deviation,
+                      std::vector<TOpFinderPlot>& plot) const;
+    void CalculateCounter(size_t point, TOpCounter& counter) const;
+    void CalculateBlock(const TOpFinderCurve& curve, double pc, double nc, size_t begin, size_t size,
+                        TMetricKernel& kernel) const;
+    void CalculateCounter(const TOpFinderCurve& curve, double pc, double nc, size_t point, TOpCounter& counter) const;
+    double CalculateAUC(const TOpFinderCurve& curve, double pc, double nc,
+                        double* prAUC = nullptr, double* averagePrecision = nullptr) const;
+    void FindOptimalThresholds(const TOpFinderCurve& curve, double pc, double nc, std::vector<TQuery>& queries) const;
+    void ResampleCurve(TPoissonSampler& sampler, TOpFinderCurve& curve, double& pc, double& nc) const;
 
     size_t ActualPosition;
     size_t PredictedPosition;
+    size_t WeightPosition;
+    bool Weighted;
     double Alpha;
-    size_t PC;
-    size_t NC;
+    double PC;
+    double NC;
     bool FixedClass;
+    bool OneVsRest;
     int PositiveClass;
     int NegativeClass;
+    size_t ThreadCount;
+    size_t MemoryLimit;
+    std::string TempDirectory;
+    size_t GroupPosition;
+    bool Grouped;
+    bool Binned;            //curve points are histogram bins rather than distinct scores
 
     TResults Results;
+    TBootstrapResults BootstrapResults;
 };
\ No newline at end of file
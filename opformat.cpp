@@ -0,0 +1,213 @@
+#include "opformat.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+static const int PRECISION = 6;     //default precision of std::ostream
+
+static char* FormatDoubleSlow(double value, char* destination) {
+    return destination + snprintf(destination, MAX_DOUBLE_LENGTH, "%.*g", PRECISION, value);
+}
+
+static char* WriteDigits(uint32_t value, int count, char* destination) {
+    for (int i = count - 1; i >= 0; --i) {
+        destination[i] = '0' + value % 10;
+        value /= 10;
+    }
+    return destination + count;
+}
+
+char* FormatDouble(double value, char* destination) {
+    //exactly representable powers of 10
+    static const double POWERS[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    if (!isfinite(value))
+        return FormatDoubleSlow(value, destination);
+    if (value == 0) {
+        if (signbit(value))
+            *destination++ = '-';
+        *destination++ = '0';
+        return destination;
+    }
+
+    double absolute = fabs(value);
+    int exponent = (int)floor(log10(absolute));
+    int scale = PRECISION - 1 - exponent;
+    if ((scale > 22) || (scale < -22))
+        return FormatDoubleSlow(value, destination);
+
+    //a single rounding of the scaled value, ties and near ties are left to printf
+    double scaled = (scale >= 0) ? absolute * POWERS[scale] : absolute / POWERS[-scale];
+    double integral = floor(scaled);
+    double fraction = scaled - integral;
+    if (fabs(fraction - 0.5) < 1e-6)
+        return FormatDoubleSlow(value, destination);
+    uint32_t digits = (uint32_t)integral + (fraction > 0.5);
+    if (digits < 100000) {
+        //log10 was off by one
+        return FormatDoubleSlow(value, destination);
+    }
+    if (digits >= 1000000) {
+        if ((digits > 1000000) || (integral >= 1000000))
+            return FormatDoubleSlow(value, destination);
+        digits = 100000;
+        ++exponent;
+    }
+
+    if (value < 0)
+        *destination++ = '-';
+    //trailing zeros are never printed by %g
+    int significant = PRECISION;
+    while ((significant > 1) && !(digits % 10)) {
+        digits /= 10;
+        --significant;
+    }
+
+    if ((exponent < -4) || (exponent >= PRECISION)) {
+        char buffer[PRECISION];
+        WriteDigits(digits, significant, buffer);
+        *destination++ = buffer[0];
+        if (significant > 1) {
+            *destination++ = '.';
+            memcpy(destination, buffer + 1, significant - 1);
+            destination += significant - 1;
+        }
+        *destination++ = 'e';
+        *destination++ = (exponent < 0) ? '-' : '+';
+        int absoluteExponent = abs(exponent);
+        destination = WriteDigits(absoluteExponent, (absoluteExponent >= 100) ? 3 : 2, destination);
+    } else if (exponent < 0) {
+        *destination++ = '0';
+        *destination++ = '.';
+        for (int i = exponent + 1; i < 0; ++i)
+            *destination++ = '0';
+        destination = WriteDigits(digits, significant, destination);
+    } else {
+        char buffer[PRECISION];
+        WriteDigits(digits, significant, buffer);
+        int integerDigits = exponent + 1;
+        for (int i = 0; i < integerDigits; ++i)
+            *destination++ = (i < significant) ? buffer[i] : '0';
+        if (significant > integerDigits) {
+            *destination++ = '.';
+            memcpy(destination, buffer + integerDigits, significant - integerDigits);
+            destination += significant - integerDigits;
+        }
+    }
+    return destination;
+}
+
+TOutputBuffer::TOutputBuffer(std::ostream& out, size_t size)
+    : Out(out)
+    , Buffer(size)
+    , Used(0)
+{
+}
+
+TOutputBuffer::~TOutputBuffer() {
+    Flush();
+}
+
+char* TOutputBuffer::Reserve(size_t size) {
+    if (Used + size > Buffer.size()) {
+        Flush();
+        if (size > Buffer.size())
+            Buffer.resize(size);
+    }
+    return Buffer.data() + Used;
+}
+
+void TOutputBuffer::Commit(char* end) {
+    Used = end - Buffer.data();
+}
+
+void TOutputBuffer::Append(const char* data, size_t size) {
+    char* destination = Reserve(size);
+    memcpy(destination, data, size);
+    Commit(destination + size);
+}
+
+void TOutputBuffer::Append(double value) {
+    Commit(FormatDouble(value, Reserve(MAX_DOUBLE_LENGTH)));
+}
+
+void TOutputBuffer::Flush() {
+    if (Used)
+        Out.write(Buffer.data(), Used);
+    TStats::Add(TStats::OutputBytes, Used);
+    Used = 0;
+}
+
+TOpFormat::TOpFormat(const std::string& format)
+    : Length(0)
+{
+    TOp literal;
+    literal.Offset = TOpCounter::InvalidOffset;
+    for (size_t i = 0; i < format.length(); ++i) {
+        if (format[i] != '%') {
+            literal.Text += format[i];
+            continue;
+        }
+        //format[length()] is '\0', so a trailing '%' is taken as "%\0" like GetLine always did
+        ++i;
+        TOpCounter::FieldOffset offset = TOpCounter::GetFieldOffset(std::string(1, format[i]));
+        if (offset == TOpCounter::InvalidOffset) {
+            literal.Text += '%';
+            literal.Text += format[i];
+            continue;
+        }
+        if (!literal.Text.empty()) {
+            Ops.push_back(literal);
+            Length += literal.Text.size();
+            literal.Text.clear();
+        }
+        TOp field;
+        field.Offset = offset;
+        Ops.push_back(field);
+        Length += MAX_DOUBLE_LENGTH;
+        if (std::find(Fields.begin(), Fields.end(), offset) == Fields.end())
+            Fields.push_back(offset);
+    }
+    if (!literal.Text.empty()) {
+        Ops.push_back(literal);
+        Length += literal.Text.size();
+    }
+}
+
+size_t TOpFormat::MaxLength() const {
+    return Length;
+}
+
+char* TOpFormat::Write(const TOpCounter& counter, char* destination) const {
+    for (size_t i = 0; i < Ops.size(); ++i) {
+        if (Ops[i].Offset == TOpCounter::InvalidOffset) {
+            memcpy(destination, Ops[i].Text.data(), Ops[i].Text.size());
+            destination += Ops[i].Text.size();
+        } else {
+            destination = FormatDouble(counter.GetValue(Ops[i].Offset), destination);
+        }
+    }
+    return destination;
+}
+
+char* TOpFormat::Write(const TMetricKernel& kernel, size_t point, char* destination) const {
+    for (size_t i = 0; i < Ops.size(); ++i) {
+        if (Ops[i].Offset == TOpCounter::InvalidOffset) {
+            memcpy(destination, Ops[i].Text.data(), Ops[i].Text.size());
+            destination += Ops[i].Text.size();
+        } else {
+            destination = FormatDouble(kernel.Column(Ops[i].Offset)[point], destination);
+        }
+    }
+    return destination;
+}
+
+const std::vector<TOpCounter::FieldOffset>& TOpFormat::GetFields() const {
+    return Fields;
+}
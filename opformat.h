@@ -0,0 +1,51 @@
+#pragma once
+#include "opcounter.h"
+#include "metrickernel.h"
+
+#include <ostream>
+
+//Formats value exactly like std::ostream << value with default flags does (printf's %g),
+//without allocations. Destination should have at least MAX_DOUBLE_LENGTH bytes.
+static const size_t MAX_DOUBLE_LENGTH = 32;
+char* FormatDouble(double value, char* destination);
+
+//Collects output in a big buffer and writes it to the stream in large blocks
+class TOutputBuffer {
+public:
+    explicit TOutputBuffer(std::ostream& out, size_t size = 1 << 20);
+    ~TOutputBuffer();
+
+    //Returns space for at least size bytes, Commit should be called with the end of written data
+    char* Reserve(size_t size);
+    void Commit(char* end);
+    void Append(const char* data, size_t size);
+    void Append(double value);
+    void Flush();
+
+private:
+    std::ostream& Out;
+    std::vector<char> Buffer;
+    size_t Used;
+};
+
+//Output format string compiled once into a list of literals and fields, see TOpCounter::GetLine
+class TOpFormat {
+public:
+    explicit TOpFormat(const std::string& format);
+
+    size_t MaxLength() const;
+    char* Write(const TOpCounter& counter, char* destination) const;
+    //Writes point of the kernel's last block, the kernel should be built with GetFields()
+    char* Write(const TMetricKernel& kernel, size_t point, char* destination) const;
+    const std::vector<TOpCounter::FieldOffset>& GetFields() const;
+
+private:
+    struct TOp {
+        TOpCounter::FieldOffset Offset;     //InvalidOffset for literals
+        std::string Text;
+    };
+
+    std::vector<TOp> Ops;
+    std::vector<TOpCounter::FieldOffset> Fields;
+    size_t Length;
+};
@@ -0,0 +1,252 @@
+#include "partial.h"
+#include "mappedfile.h"
+
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+
+static const char PARTIAL_MAGIC[4] = {'O', 'T', 'F', 'P'};
+static const uint32_t PARTIAL_VERSION = 4;
+static const uint32_t PARTIAL_BINNED = 1;
+static const uint32_t PARTIAL_CACHE = 2;        //source fingerprint is set
+
+struct TPartialHeader {
+    char Magic[4];
+    uint32_t Version;
+    uint32_t Flags;
+    uint32_t Reserved;
+    uint64_t Size;
+    double PC;
+    double NC;
+    uint64_t Bins;      //zero for exact curves
+    double Min;
+    double Max;
+    TSourceFingerprint Source;
+};
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+static uint64_t Hash(const char* begin, const char* end, uint64_t hash = FNV_OFFSET) {
+    for (; begin != end; ++begin)
+        hash = (hash ^ (unsigned char)*begin) * FNV_PRIME;
+    return hash;
+}
+
+bool TSourceFingerprint::operator==(const TSourceFingerprint& fingerprint) const {
+    return (Size == fingerprint.Size) && (ModificationTime == fingerprint.ModificationTime)
+        && (Hash == fingerprint.Hash) && (Parameters == fingerprint.Parameters);
+}
+
+bool GetFingerprint(const std::string& fileName, const std::string& parameters, TSourceFingerprint& fingerprint) {
+    static const size_t SAMPLE_SIZE = 1 << 20;
+    struct stat st;
+    if ((stat(fileName.c_str(), &st) != 0) || !S_ISREG(st.st_mode))
+        return false;
+    TMappedFile file;
+    if (!file.Open(fileName))
+        return false;
+    fingerprint.Size = file.Size();
+    fingerprint.ModificationTime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    if (file.Size() <= 2 * SAMPLE_SIZE) {
+        fingerprint.Hash = Hash(file.Begin(), file.End());
+    } else {
+        fingerprint.Hash = Hash(file.Begin(), file.Begin() + SAMPLE_SIZE);
+        fingerprint.Hash = Hash(file.End() - SAMPLE_SIZE, file.End(), fingerprint.Hash);
+    }
+    fingerprint.Parameters = Hash(parameters.data(), parameters.data() + parameters.size());
+    return true;
+}
+
+//Mapped partial file with a position of the next run to merge
+class TPartialReader {
+public:
+    explicit TPartialReader(const std::string& fileName)
+        : FileName(fileName)
+        , Position(0)
+    {
+        if (!File.Open(fileName) || (File.Size() < sizeof(TPartialHeader)))
+            throw std::runtime_error("Can't read partial results file " + fileName);
+        Header = reinterpret_cast<const TPartialHeader*>(File.Begin());
+        if (memcmp(Header->Magic, PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC)) || (Header->Version != PARTIAL_VERSION))
+            throw std::runtime_error(fileName + " is not a partial results file");
+        if (File.Size() != sizeof(TPartialHeader) + Header->Size * 3 * sizeof(double))
+            throw std::runtime_error("Partial results file " + fileName + " is truncated");
+        Thresholds = reinterpret_cast<const double*>(File.Begin() + sizeof(TPartialHeader));
+        Positives = Thresholds + Header->Size;
+        Negatives = Positives + Header->Size;
+        //merging relies on thresholds comparing equal to themselves
+        for (size_t i = 0; i < Header->Size; ++i) {
+            if (!isfinite(Thresholds[i]))
+                throw std::runtime_error("Partial results file " + fileName + " has invalid thresholds");
+        }
+    }
+
+    //Drops pages of merged runs from resident memory
+    void Release() const {
+        TMappedFile::Release((const char*)Thresholds, (const char*)(Thresholds + Position));
+        TMappedFile::Release((const char*)Positives, (const char*)(Positives + Position));
+        TMappedFile::Release((const char*)Negatives, (const char*)(Negatives + Position));
+    }
+
+    std::string FileName;
+    const TPartialHeader* Header;
+    const double* Thresholds;
+    const double* Positives;
+    const double* Negatives;
+    size_t Position;
+
+private:
+    TMappedFile File;
+};
+
+struct TPartialOrder {
+    bool operator()(const TPartialReader* a, const TPartialReader* b) const {
+        return a->Thresholds[a->Position] > b->Thresholds[b->Position];
+    }
+};
+
+void WritePartial(const std::string& fileName, const TOpFinderCurve& curve, double pc, double nc,
+        const TOpFinderHistogram* histogram, const TSourceFingerprint* source) {
+    std::ofstream out(fileName, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("Can't write partial results file " + fileName);
+    TPartialHeader header;
+    memcpy(header.Magic, PARTIAL_MAGIC, sizeof(PARTIAL_MAGIC));
+    header.Version = PARTIAL_VERSION;
+    header.Flags = (histogram ? PARTIAL_BINNED : 0) | (source ? PARTIAL_CACHE : 0);
+    header.Reserved = 0;
+    header.Size = curve.Size();
+    header.PC = pc;
+    header.NC = nc;
+    header.Bins = histogram ? histogram->Size() : 0;
+    header.Min = histogram ? histogram->Min : 0;
+    header.Max = histogram ? histogram->Max : 0;
+    if (source)
+        header.Source = *source;
+    else
+        memset(&header.Source, 0, sizeof(header.Source));
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)curve.Thresholds.data(), curve.Size() * sizeof(double));
+
+    //run sizes are differences of passed counts of neighbouring points
+    const std::vector<double>* passed[2] = {&curve.PositivePassed, &curve.NegativePassed};
+    const double totals[2] = {pc, nc};
+    std::vector<double> runs;
+    runs.reserve(1 << 16);
+    for (size_t c = 0; c < 2; ++c) {
+        for (size_t i = 0; i < curve.Size(); ++i) {
+            double next = (i + 1 < curve.Size()) ? (*passed[c])[i + 1] : totals[c];
+            runs.push_back(next - (*passed[c])[i]);
+            if ((runs.size() == runs.capacity()) || (i + 1 == curve.Size())) {
+                out.write((const char*)runs.data(), runs.size() * sizeof(double));
+                runs.clear();
+            }
+        }
+    }
+    if (!out)
+        throw std::runtime_error("Can't write partial results file " + fileName);
+}
+
+//Merges runs of the readers, the callback gets every distinct threshold with counts passed
+//below it. Pages of merged runs are released from time to time.
+template <typename TCallback>
+static void MergeRuns(const std::vector<TPartialReader*>& readers, double& pc, double& nc, TCallback callback) {
+    static const size_t RELEASE_RUNS = 1 << 16;
+    std::priority_queue<TPartialReader*, std::vector<TPartialReader*>, TPartialOrder> queue;
+    pc = 0;
+    nc = 0;
+    for (size_t i = 0; i < readers.size(); ++i) {
+        readers[i]->Position = 0;
+        if (readers[i]->Header->Size)
+            queue.push(readers[i]);
+    }
+
+    while (!queue.empty()) {
+        double thr = queue.top()->Thresholds[queue.top()->Position];
+        callback(thr, pc, nc);
+        while (!queue.empty() && (queue.top()->Thresholds[queue.top()->Position] == thr)) {
+            TPartialReader* reader = queue.top();
+            queue.pop();
+            pc += reader->Positives[reader->Position];
+            nc += reader->Negatives[reader->Position];
+            if (!(++reader->Position % RELEASE_RUNS))
+                reader->Release();
+            if (reader->Position < reader->Header->Size)
+                queue.push(reader);
+            else
+                reader->Release();
+        }
+    }
+}
+
+//Distinct thresholds are counted in a first pass, so the curve takes 24 bytes per
+//threshold and no more, and merged runs don't stay resident
+static void MergeReaders(const std::vector<TPartialReader*>& readers, TOpFinderCurve& curve, double& pc, double& nc,
+        TOpFinderHistogram& histogram, bool& binned) {
+    //runs of different bins or of exact scores can't be told apart by thresholds
+    const TPartialHeader& first = *readers.front()->Header;
+    for (size_t i = 1; i < readers.size(); ++i) {
+        const TPartialHeader& header = *readers[i]->Header;
+        if (((header.Flags & PARTIAL_BINNED) != (first.Flags & PARTIAL_BINNED)) || (header.Bins != first.Bins)
+                || (header.Min != first.Min) || (header.Max != first.Max))
+            throw std::runtime_error("Partial results files " + readers.front()->FileName + " and " + readers[i]->FileName
+                                     + " have different histograms, binned and exact ones can't be merged either");
+    }
+    curve.Clear();
+    binned = first.Flags & PARTIAL_BINNED;
+    if (binned)
+        histogram.Reset(first.Bins, first.Min, first.Max);
+
+    size_t size = 0;
+    MergeRuns(readers, pc, nc, [&size](double, double, double) { ++size; });
+    curve.Thresholds.reserve(size);
+    curve.PositivePassed.reserve(size);
+    curve.NegativePassed.reserve(size);
+    MergeRuns(readers, pc, nc, [&curve](double thr, double passedPositives, double passedNegatives) {
+        curve.Thresholds.push_back(thr);
+        curve.PositivePassed.push_back(passedPositives);
+        curve.NegativePassed.push_back(passedNegatives);
+    });
+}
+
+void MergePartials(const std::vector<std::string>& fileNames, TOpFinderCurve& curve, double& pc, double& nc,
+        TOpFinderHistogram& histogram, bool& binned) {
+    std::vector<TPartialReader*> readers;
+    try {
+        for (size_t i = 0; i < fileNames.size(); ++i)
+            readers.push_back(new TPartialReader(fileNames[i]));
+    } catch (...) {
+        for (size_t i = 0; i < readers.size(); ++i)
+            delete readers[i];
+        throw;
+    }
+    try {
+        MergeReaders(readers, curve, pc, nc, histogram, binned);
+    } catch (...) {
+        for (size_t i = 0; i < readers.size(); ++i)
+            delete readers[i];
+        throw;
+    }
+    for (size_t i = 0; i < readers.size(); ++i)
+        delete readers[i];
+}
+
+bool ReadCachedPartial(const std::string& fileName, const TSourceFingerprint& source,
+        TOpFinderCurve& curve, double& pc, double& nc, TOpFinderHistogram& histogram, bool& binned) {
+    std::unique_ptr<TPartialReader> reader;
+    try {
+        reader.reset(new TPartialReader(fileName));
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    if (!(reader->Header->Flags & PARTIAL_CACHE) || !(reader->Header->Source == source))
+        return false;
+    MergeReaders(std::vector<TPartialReader*>(1, reader.get()), curve, pc, nc, histogram, binned);
+    return true;
+}
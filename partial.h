@@ -0,0 +1,45 @@
+#pragma once
+#include "opfinder.h"
+
+#include <stdint.h>
+
+/*
+    Partial results of a shard: distinct thresholds (or histogram bins) with counts of
+    positive and negative records in each run. Counts are sums of record weights, so they
+    are stored as doubles. Files are written in native byte order:
+        header      "OTFP", version, flags, runs count, PC, NC, histogram bins, min and max,
+                    source fingerprint
+        double      thresholds[runs]    ascending
+        double      positives[runs]
+        double      negatives[runs]
+    Any number of partials of the same histogram, or of exact curves, can be merged into the
+    curve of the whole data set, merge takes O(runs * log(files)) time and doesn't depend on records count. Its memory
+    is the merged curve, 24 bytes per distinct threshold, merged runs of files are released.
+    A partial with a source fingerprint serves as a cache of the parsed and sorted input.
+*/
+
+//Identity of the source file and of parsing parameters. Size and modification time are
+//checked together with a hash of file's head and tail, so the check doesn't read the file.
+struct TSourceFingerprint {
+    uint64_t Size;
+    int64_t ModificationTime;   //nanoseconds
+    uint64_t Hash;
+    uint64_t Parameters;
+
+    bool operator==(const TSourceFingerprint& fingerprint) const;
+};
+
+bool GetFingerprint(const std::string& fileName, const std::string& parameters, TSourceFingerprint& fingerprint);
+
+//Histogram is the one the curve is binned by, null for exact curves
+void WritePartial(const std::string& fileName, const TOpFinderCurve& curve, double pc, double nc,
+                  const TOpFinderHistogram* histogram, const TSourceFingerprint* source = nullptr);
+//Partials of different histograms, binned and exact ones among them, are rejected. The histogram
+//is reset to bins and range of binned partials with empty bins, binned is set for them.
+void MergePartials(const std::vector<std::string>& fileNames, TOpFinderCurve& curve, double& pc, double& nc,
+                   TOpFinderHistogram& histogram, bool& binned);
+
+//Loads a partial written for the given source, returns false if there is no such file
+//or it has been written for another source or parameters
+bool ReadCachedPartial(const std::string& fileName, const TSourceFingerprint& source,
+                       TOpFinderCurve& curve, double& pc, double& nc, TOpFinderHistogram& histogram, bool& binned);
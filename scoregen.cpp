@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <stdexcept>
+#include <getopt.h>
+
+/*
+    Deterministic generator of synthetic (label, score) rows for benchmarks. Labels are
+    drawn with the given positive rate, scores come from class conditional distributions:
+        normal      logistic of N(+-separation / 2, 1)
+        uniform     densities 2s for positives and 2(1 - s) for negatives on [0; 1]
+    With distinct > 0 scores are rounded to that many levels, which controls tie density.
+    Random numbers are produced by splitmix64, so labels are the same for a given seed whatever
+    the standard library. Scores go through libm and printf, their last digits may differ
+    between platforms.
+*/
+class TRandom {
+public:
+    explicit TRandom(uint64_t seed) : State(seed) {}
+
+    uint64_t Next() {
+        uint64_t z = (State += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    //Uniform in [0; 1)
+    double Uniform() {
+        return (Next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    double Normal() {
+        double u = 1.0 - Uniform();
+        return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * Uniform());
+    }
+
+private:
+    uint64_t State;
+};
+
+void print_usage() {
+    fprintf(stderr, "Usage: ScoreGenerator [options] > data.tsv\n"
+            "\t-n, --rows\n\t\tNumber of rows.\n"
+            "\t-p, --positive-rate\n\t\tShare of positive records in (0;1).\n"
+            "\t-d, --distribution\n\t\tScore distribution: normal or uniform.\n"
+            "\t-s, --separation\n\t\tDistance between class means of the normal distribution.\n"
+            "\t-k, --distinct\n\t\tNumber of score levels, 0 for full precision. Fewer levels give more ties.\n"
+            "\t-S, --seed\n\t\tRandom seed.\n"
+            "Rows are written as label and score separated by tab: -A 0 -P 1.\n");
+}
+
+static struct option long_options[] =
+{
+    {"rows",            required_argument, 0, 'n'},
+    {"positive-rate",   required_argument, 0, 'p'},
+    {"distribution",    required_argument, 0, 'd'},
+    {"separation",      required_argument, 0, 's'},
+    {"distinct",        required_argument, 0, 'k'},
+    {"seed",            required_argument, 0, 'S'},
+    {"help",            no_argument, 0, '?'},
+    {0, 0, 0, 0}
+};
+
+int main(int argc, char* argv[]) {
+    uint64_t rows = 1000000;
+    double positiveRate = 0.5;
+    std::string distribution = "normal";
+    double separation = 2.0;
+    uint64_t distinct = 0;
+    uint64_t seed = 0;
+
+    int opt = 0;
+    int long_index = 0;
+    while ((opt = getopt_long(argc, argv, "n:p:d:s:k:S:?", long_options, &long_index)) != -1) {
+        switch (opt) {
+            case 'n': rows = strtoull(optarg, nullptr, 10); break;
+            case 'p': positiveRate = atof(optarg); break;
+            case 'd': distribution = optarg; break;
+            case 's': separation = atof(optarg); break;
+            case 'k': distinct = strtoull(optarg, nullptr, 10); break;
+            case 'S': seed = strtoull(optarg, nullptr, 10); break;
+            case '?': print_usage(); return 1;
+        }
+    }
+    if (!(positiveRate > 0) || !(positiveRate < 1))
+        throw std::runtime_error("Positive rate should be in (0;1).");
+    bool normal = (distribution == "normal");
+    if (!normal && (distribution != "uniform"))
+        throw std::runtime_error("Unknown distribution " + distribution);
+
+    static char buffer[1 << 16];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    TRandom random(seed);
+    for (uint64_t i = 0; i < rows; ++i) {
+        bool positive = random.Uniform() < positiveRate;
+        double score;
+        if (normal)
+            score = 1.0 / (1.0 + exp(-(random.Normal() + (positive ? separation : -separation) / 2.0)));
+        else
+            score = positive ? sqrt(random.Uniform()) : 1.0 - sqrt(random.Uniform());
+        if (distinct)
+            score = floor(score * distinct) / distinct;
+        printf("%d\t%.9g\n", positive ? 1 : 0, score);
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include "scoresort.h"
+#include "threadpool.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+
+static const size_t RADIX_MIN_SIZE = 1 << 12;      //smaller columns go to std::sort
+static const size_t BUCKET_MIN_SIZE = 1 << 7;      //smaller buckets go to std::sort
+static const size_t PARALLEL_MIN_SIZE = 1 << 16;   //smaller buckets aren't worth a task
+static const uint64_t SIGN_BIT = (uint64_t)1 << 63;
+
+//Negative doubles have all bits inverted and positive ones get the sign bit set,
+//so unsigned comparison of keys is the same as comparison of doubles
+static inline uint64_t ToKey(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits == SIGN_BIT)
+        bits = 0;
+    return (bits & SIGN_BIT) ? ~bits : (bits | SIGN_BIT);
+}
+
+static inline double FromKey(uint64_t key) {
+    uint64_t bits = (key & SIGN_BIT) ? (key & ~SIGN_BIT) : ~key;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//Key with its record weight, moved around as a whole
+struct TWeightedKey {
+    uint64_t Key;
+    double Weight;
+
+    bool operator<(const TWeightedKey& key) const {
+        return Key < key.Key;
+    }
+};
+
+static inline uint64_t KeyOf(uint64_t key) {
+    return key;
+}
+
+static inline uint64_t KeyOf(const TWeightedKey& key) {
+    return key.Key;
+}
+
+template <class TItem>
+static void RadixSort(TItem* begin, TItem* end, int shift, TThreadPool* pool) {
+    size_t size = end - begin;
+    if (size < BUCKET_MIN_SIZE) {
+        std::sort(begin, end);
+        return;
+    }
+
+    //digits shared by all keys are skipped without moving anything
+    uint64_t difference = 0;
+    for (const TItem* i = begin; i != end; ++i)
+        difference |= KeyOf(*i) ^ KeyOf(*begin);
+    if (!difference)
+        return;
+    while (!(difference >> shift))
+        shift -= 8;
+
+    size_t counts[256];
+    memset(counts, 0, sizeof(counts));
+    for (const TItem* i = begin; i != end; ++i)
+        ++counts[(KeyOf(*i) >> shift) & 0xFF];
+
+    TItem* heads[256];
+    TItem* tails[256];
+    TItem* position = begin;
+    for (size_t i = 0; i < 256; ++i) {
+        heads[i] = position;
+        position += counts[i];
+        tails[i] = position;
+    }
+
+    //american flag permutation: every key is swapped straight into its bucket
+    for (size_t bucket = 0; bucket < 256; ++bucket) {
+        while (heads[bucket] != tails[bucket]) {
+            TItem key = *heads[bucket];
+            size_t digit = (KeyOf(key) >> shift) & 0xFF;
+            while (digit != bucket) {
+                std::swap(key, *heads[digit]++);
+                digit = (KeyOf(key) >> shift) & 0xFF;
+            }
+            *heads[bucket]++ = key;
+        }
+    }
+
+    if (!shift)
+        return;
+    position = begin;
+    for (size_t i = 0; i < 256; ++i) {
+        TItem* bucketEnd = position + counts[i];
+        if (counts[i] > 1) {
+            if (pool && (counts[i] >= PARALLEL_MIN_SIZE))
+                pool->Add(std::bind(&RadixSort<TItem>, position, bucketEnd, shift - 8, pool));
+            else
+                RadixSort(position, bucketEnd, shift - 8, pool);
+        }
+        position = bucketEnd;
+    }
+}
+
+void SortScores(std::vector<double>& scores, size_t threads) {
+    if (scores.size() < RADIX_MIN_SIZE) {
+        //adding 0.0 turns -0.0 into 0.0 as keys of the radix sort do
+        for (size_t i = 0; i < scores.size(); ++i)
+            scores[i] += 0.0;
+        std::sort(scores.begin(), scores.end());
+        return;
+    }
+
+    //keys are stored in place of the doubles and only accessed through memcpy here
+    double* values = scores.data();
+    for (size_t i = 0; i < scores.size(); ++i) {
+        uint64_t key = ToKey(values[i]);
+        memcpy(values + i, &key, sizeof(key));
+    }
+    uint64_t* keys = reinterpret_cast<uint64_t*>(values);
+
+    threads = std::min(threads, scores.size() / PARALLEL_MIN_SIZE);
+    if (threads > 1) {
+        TThreadPool pool(threads);
+        RadixSort(keys, keys + scores.size(), 56, &pool);
+        pool.Wait();
+    } else {
+        RadixSort(keys, keys + scores.size(), 56, nullptr);
+    }
+
+    for (size_t i = 0; i < scores.size(); ++i) {
+        uint64_t key;
+        memcpy(&key, values + i, sizeof(key));
+        values[i] = FromKey(key);
+    }
+}
+
+void SortScores(std::vector<double>& scores, std::vector<double>& weights, size_t threads) {
+    //pairs take the place of both columns only while they are sorted
+    std::vector<TWeightedKey> items(scores.size());
+    for (size_t i = 0; i < scores.size(); ++i) {
+        items[i].Key = ToKey(scores[i]);
+        items[i].Weight = weights[i];
+    }
+    if (items.size() < RADIX_MIN_SIZE) {
+        std::sort(items.begin(), items.end());
+    } else {
+        threads = std::min(threads, items.size() / PARALLEL_MIN_SIZE);
+        if (threads > 1) {
+            TThreadPool pool(threads);
+            RadixSort(items.data(), items.data() + items.size(), 56, &pool);
+            pool.Wait();
+        } else {
+            RadixSort(items.data(), items.data() + items.size(), 56, nullptr);
+        }
+    }
+    for (size_t i = 0; i < items.size(); ++i) {
+        scores[i] = FromKey(items[i].Key);
+        weights[i] = items[i].Weight;
+    }
+}
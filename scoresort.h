@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+/*
+    Sorts scores ascending. Small columns go to std::sort, larger ones are sorted
+    in place with MSD radix sort over order-preserving integer keys of IEEE-754
+    doubles. Buckets of big columns are sorted on a thread pool, so no extra memory
+    is needed in any case. Equal values are indistinguishable, hence the result is
+    exactly the std::sort one; -0.0 is stored as 0.0 since they compare equal anyway.
+*/
+void SortScores(std::vector<double>& scores, size_t threads = 1);
+
+//Sorts scores the same way moving every weight together with its score. Pairs are sorted
+//in a temporary array, so it takes twice the memory of both columns.
+void SortScores(std::vector<double>& scores, std::vector<double>& weights, size_t threads = 1);
@@ -0,0 +1,459 @@
+#include "server.h"
+#include "common.h"
+#include "threadpool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+static const uint32_t MAX_FRAME_SIZE = 1u << 30;
+static const int FRAME_TIMEOUT_SECONDS = 10;    //a client stalled in the middle of a frame is dropped
+
+static bool ReadAll(int fd, char* data, size_t size) {
+    while (size) {
+        ssize_t done = read(fd, data, size);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return false;
+        data += done;
+        size -= done;
+    }
+    return true;
+}
+
+static bool WriteAll(int fd, const char* data, size_t size) {
+    while (size) {
+        ssize_t done = send(fd, data, size, MSG_NOSIGNAL);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return false;
+        data += done;
+        size -= done;
+    }
+    return true;
+}
+
+static bool ReadFrame(int fd, std::string& payload) {
+    unsigned char header[4];
+    if (!ReadAll(fd, (char*)header, sizeof(header)))
+        return false;
+    uint32_t size = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+    if (size > MAX_FRAME_SIZE)
+        return false;
+    payload.resize(size);
+    return ReadAll(fd, &payload[0], size);
+}
+
+static bool WriteFrame(int fd, const std::string& payload) {
+    uint32_t size = payload.size();
+    unsigned char header[4] = {(unsigned char)size, (unsigned char)(size >> 8),
+                               (unsigned char)(size >> 16), (unsigned char)(size >> 24)};
+    return WriteAll(fd, (const char*)header, sizeof(header)) && WriteAll(fd, payload.data(), payload.size());
+}
+
+static sockaddr_un SocketAddress(const std::string& socketPath) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path is too long: " + socketPath);
+    memcpy(address.sun_path, socketPath.data(), socketPath.size());
+    return address;
+}
+
+TOpFinder TEvalServer::TConfig::CreateFinder() const {
+    TOpFinder finder(Actual, Predicted, Positive, Negative, Fixed, Alpha);
+    finder.SetHistogram(Bins, Min, Max);
+    if (Weighted)
+        finder.SetWeightColumn(Weight);
+    return finder;
+}
+
+TEvalServer::TEvalServer(const std::string& socketPath, size_t threads)
+    : SocketPath(socketPath)
+    , Threads(threads)
+    , Listener(-1)
+    , Stopping(false)
+{
+    sockaddr_un address = SocketAddress(socketPath);
+    if (pipe(WakeUpPipe) != 0)
+        throw std::runtime_error("Can't create pipe");
+    fcntl(WakeUpPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(WakeUpPipe[1], F_SETFL, O_NONBLOCK);
+    Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Listener < 0) {
+        close(WakeUpPipe[0]);
+        close(WakeUpPipe[1]);
+        throw std::runtime_error("Can't create socket");
+    }
+    unlink(socketPath.c_str());
+    if ((bind(Listener, (const sockaddr*)&address, sizeof(address)) != 0) || (listen(Listener, SOMAXCONN) != 0)) {
+        close(Listener);
+        close(WakeUpPipe[0]);
+        close(WakeUpPipe[1]);
+        throw std::runtime_error("Can't listen on socket " + socketPath);
+    }
+}
+
+TEvalServer::~TEvalServer() {
+    if (Listener >= 0)
+        close(Listener);
+    close(WakeUpPipe[0]);
+    close(WakeUpPipe[1]);
+    unlink(SocketPath.c_str());
+}
+
+//Idle connections are polled here, a connection with a request is taken out of polling
+//until its request is answered, so a client never has two requests executed at once
+void TEvalServer::Run() {
+    //polling thread never executes requests itself, so at least two threads are needed
+    TThreadPool pool(std::max(Threads, (size_t)2));
+    std::vector<int> clients;
+    std::vector<pollfd> polled;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(Lock);
+            if (Stopping)
+                break;
+            clients.insert(clients.end(), Returned.begin(), Returned.end());
+            Returned.clear();
+        }
+        polled.assign(clients.size() + 2, pollfd());
+        polled[0].fd = Listener;
+        polled[1].fd = WakeUpPipe[0];
+        for (size_t i = 0; i < clients.size(); ++i)
+            polled[i + 2].fd = clients[i];
+        for (size_t i = 0; i < polled.size(); ++i)
+            polled[i].events = POLLIN;
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("Can't poll connections");
+        }
+
+        if (polled[1].revents) {
+            char buffer[64];
+            while (read(WakeUpPipe[0], buffer, sizeof(buffer)) > 0)
+                ;
+        }
+        size_t idle = 0;
+        for (size_t i = 0; i < clients.size(); ++i) {
+            if (polled[i + 2].revents) {
+                int client = clients[i];
+                pool.Add([this, client]() { Serve(client); });
+            } else
+                clients[idle++] = clients[i];
+        }
+        clients.resize(idle);
+        if (polled[0].revents & POLLIN) {
+            int client = accept(Listener, nullptr, nullptr);
+            if (client >= 0) {
+                timeval timeout = {FRAME_TIMEOUT_SECONDS, 0};
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                clients.push_back(client);
+            } else if ((errno != EINTR) && (errno != EAGAIN) && (errno != ECONNABORTED))
+                throw std::runtime_error("Can't accept connection");
+        }
+    }
+    pool.Wait();
+    clients.insert(clients.end(), Returned.begin(), Returned.end());
+    Returned.clear();
+    for (size_t i = 0; i < clients.size(); ++i)
+        close(clients[i]);
+}
+
+void TEvalServer::Serve(int client) {
+    std::string request;
+    if (!ReadFrame(client, request) || !WriteFrame(client, Execute(request))) {
+        close(client);
+        return;
+    }
+    std::unique_lock<std::mutex> guard(Lock);
+    Returned.push_back(client);
+    WakeUp();
+}
+
+//Lock should be held, a full pipe already wakes the polling thread up
+void TEvalServer::WakeUp() {
+    char signal = 0;
+    ssize_t written = write(WakeUpPipe[1], &signal, 1);
+    (void)written;
+}
+
+std::string TEvalServer::Execute(const std::string& request) {
+    size_t lineEnd = request.find('\n');
+    std::string line = request.substr(0, lineEnd);
+    const char* body = request.data() + ((lineEnd == std::string::npos) ? request.size() : lineEnd + 1);
+    const char* bodyEnd = request.data() + request.size();
+
+    std::vector<std::string> arguments;
+    std::istringstream words(line);
+    std::string word;
+    while (words >> word)
+        arguments.push_back(word);
+
+    try {
+        if (arguments.empty())
+            throw std::runtime_error("Empty command");
+        const std::string& command = arguments[0];
+        if (command == "LIST") {
+            std::ostringstream out;
+            std::unique_lock<std::mutex> guard(Lock);
+            for (std::map<std::string, std::shared_ptr<TDataset> >::const_iterator it = Datasets.begin(); it != Datasets.end(); ++it)
+                out << it->first << "\n";
+            return "OK\n" + out.str();
+        }
+        if (command == "STOP") {
+            std::unique_lock<std::mutex> guard(Lock);
+            Stopping = true;
+            WakeUp();
+            return "OK\n";
+        }
+        if (arguments.size() < 2)
+            throw std::runtime_error("Data set name is missing");
+        const std::string& name = arguments[1];
+        if (command == "OPEN")
+            return Open(arguments);
+        if ((command == "INGEST") || (command == "RETRACT"))
+            return Ingest(name, body, bodyEnd, command == "RETRACT");
+        if (command == "METRICS")
+            return Metrics(name, arguments);
+        if (command == "DROP") {
+            std::unique_lock<std::mutex> guard(Lock);
+            if (!Datasets.erase(name))
+                throw std::runtime_error("No such data set: " + name);
+            return "OK\n";
+        }
+
+        std::shared_ptr<TDataset> dataset = GetDataset(name);
+        std::ostringstream out;
+        if (command == "AUC") {
+            TOpFinder::TResults results;
+            if (dataset->Online) {
+                //AUC is kept by the online curve, PR AUC and average precision need the curve of bins
+                std::unique_lock<std::mutex> ingestGuard(dataset->IngestLock);
+                Refresh(*dataset);
+                {
+                    std::unique_lock<std::mutex> guard(Lock);
+                    results = dataset->Finder->GetResults();
+                }
+                results.AUC = dataset->Online->GetAUC();
+                results.AUCError = dataset->Online->GetAUCError();
+            } else
+                results = GetFinder(*dataset)->GetResults();
+            out << "AUC\t" << results.AUC << "\nPR AUC\t" << results.PRAUC
+                << "\nAverage precision\t" << results.AveragePrecision << "\n";
+            if (results.AUCError > 0)
+                out << "AUC error bound\t" << results.AUCError << "\n";
+        } else if (command == "QUERY") {
+            std::istringstream lines(std::string(body, bodyEnd));
+            std::vector<TOpFinder::TQuery> queries = TOpFinder::ReadQueries(lines, dataset->Config.Alpha);
+            GetFinder(*dataset)->FindOptimalThresholds(queries);
+            for (size_t i = 0; i < queries.size(); ++i) {
+                const TOpFinder::TQuery& query = queries[i];
+                if (!query.Found)
+                    out << "-\t-\t-\n";
+                else if (query.ArgumentName.empty())
+                    out << query.OptimalThreshold << "\t" << query.TargetValue << "\t-\n";
+                else
+                    out << query.OptimalThreshold << "\t" << query.TargetValue << "\t" << query.ArgumentValue << "\n";
+            }
+        } else if (command == "PLOT") {
+            if (arguments.size() < 5)
+                throw std::runtime_error("PLOT needs x, y axes and points count");
+            double deviation = (arguments.size() > 5) ? atof(arguments[5].c_str()) : 0;
+            GetFinder(*dataset)->WritePlot(out, arguments[2], arguments[3], atoi(arguments[4].c_str()), deviation);
+        } else {
+            throw std::runtime_error("Unknown command " + command);
+        }
+        return "OK\n" + out.str();
+    } catch (const std::exception& e) {
+        return std::string("ERROR ") + e.what() + "\n";
+    }
+}
+
+std::shared_ptr<TEvalServer::TDataset> TEvalServer::GetDataset(const std::string& name) {
+    std::unique_lock<std::mutex> guard(Lock);
+    std::map<std::string, std::shared_ptr<TDataset> >::const_iterator it = Datasets.find(name);
+    if (it == Datasets.end())
+        throw std::runtime_error("No such data set: " + name);
+    return it->second;
+}
+
+std::shared_ptr<const TOpFinder> TEvalServer::GetFinder(TDataset& dataset) {
+    if (dataset.Online) {
+        std::unique_lock<std::mutex> ingestGuard(dataset.IngestLock);
+        Refresh(dataset);
+    }
+    std::unique_lock<std::mutex> guard(Lock);
+    return dataset.Finder;
+}
+
+void TEvalServer::Refresh(TDataset& dataset) {
+    if (!dataset.Stale)
+        return;
+    std::shared_ptr<TOpFinder> finder(new TOpFinder(dataset.Config.CreateFinder()));
+    finder->ReadFromOnline(*dataset.Online);
+    finder->Calculate();
+    std::unique_lock<std::mutex> guard(Lock);
+    dataset.Finder = finder;
+    dataset.Stale = false;
+}
+
+std::string TEvalServer::Open(const std::vector<std::string>& arguments) {
+    if (arguments.size() < 4)
+        throw std::runtime_error("OPEN needs data set name, actual and predicted columns");
+    std::shared_ptr<TDataset> dataset(new TDataset());
+    TConfig& config = dataset->Config;
+    config.Actual = atoi(arguments[2].c_str());
+    config.Predicted = atoi(arguments[3].c_str());
+    config.Positive = 1;
+    config.Negative = 0;
+    config.Fixed = true;
+    config.Alpha = 0.5;
+    config.Weighted = false;
+    config.Weight = 0;
+    config.Bins = 0;
+    config.Min = 0;
+    config.Max = 1;
+    for (size_t i = 4; i < arguments.size(); ++i) {
+        size_t separator = arguments[i].find('=');
+        if (separator == std::string::npos)
+            throw std::runtime_error("Option should be in key=value format: " + arguments[i]);
+        std::string key = arguments[i].substr(0, separator);
+        std::string value = arguments[i].substr(separator + 1);
+        if (key == "pc") {
+            config.Positive = atoi(value.c_str());
+        } else if (key == "nc") {
+            config.Negative = atoi(value.c_str());
+        } else if (key == "C") {
+            config.Positive = atoi(value.c_str());
+            config.Fixed = false;
+        } else if (key == "weight") {
+            config.Weighted = true;
+            config.Weight = atoi(value.c_str());
+        } else if (key == "alpha") {
+            config.Alpha = atof(value.c_str());
+        } else if (key == "bins") {
+            config.Bins = atoi(value.c_str());
+        } else if (key == "range") {
+            std::vector<std::string> range = split(value, ':');
+            if (range.size() != 2)
+                throw std::runtime_error("Histogram range should be in MIN:MAX format.");
+            config.Min = atof(range[0].c_str());
+            config.Max = atof(range[1].c_str());
+        } else {
+            throw std::runtime_error("Unknown option " + key);
+        }
+    }
+    if ((config.Alpha < 0) || (config.Alpha > 1))
+        throw std::runtime_error("Alpha should be in [0;1]");
+
+    if (config.Bins)
+        dataset->Online.reset(new TOnlineCurve(config.Bins, config.Min, config.Max));
+    dataset->Stale = false;
+    std::shared_ptr<TOpFinder> finder(new TOpFinder(config.CreateFinder()));
+    finder->Calculate();
+    dataset->Finder = finder;
+    std::unique_lock<std::mutex> guard(Lock);
+    Datasets[arguments[1]] = dataset;
+    return "OK\n";
+}
+
+std::string TEvalServer::Ingest(const std::string& name, const char* begin, const char* end, bool remove) {
+    std::shared_ptr<TDataset> dataset = GetDataset(name);
+    std::unique_lock<std::mutex> ingestGuard(dataset->IngestLock);
+    if (remove && !dataset->Online)
+        throw std::runtime_error("Rows can be removed from binned data sets only");
+
+    if (dataset->Online) {
+        //batch scores are exact, the online curve puts them into bins
+        TConfig config = dataset->Config;
+        config.Bins = 0;
+        TOpFinder batch = config.CreateFinder();
+        size_t rejected = batch.ReadFromMemory(begin, end);
+        batch.UpdateOnline(*dataset->Online, remove);
+        dataset->Stale = true;
+        return "OK\nRejected lines\t" + std::to_string(rejected) + "\n";
+    }
+
+    std::shared_ptr<const TOpFinder> current;
+    {
+        std::unique_lock<std::mutex> guard(Lock);
+        current = dataset->Finder;
+    }
+    TOpFinder batch = dataset->Config.CreateFinder();
+    size_t rejected = batch.ReadFromMemory(begin, end);
+    std::vector<const TOpFinder*> finders;
+    finders.push_back(current.get());
+    finders.push_back(&batch);
+    std::shared_ptr<TOpFinder> merged(new TOpFinder(dataset->Config.CreateFinder()));
+    merged->MergeCurves(finders);
+    merged->Calculate();
+
+    std::unique_lock<std::mutex> guard(Lock);
+    dataset->Finder = merged;
+    return "OK\nRejected lines\t" + std::to_string(rejected) + "\n";
+}
+
+std::string TEvalServer::Metrics(const std::string& name, const std::vector<std::string>& arguments) {
+    if (arguments.size() < 4)
+        throw std::runtime_error("METRICS needs threshold and format string");
+    std::shared_ptr<TDataset> dataset = GetDataset(name);
+    if (!dataset->Online)
+        throw std::runtime_error("Metrics at a threshold are kept for binned data sets only");
+    std::string format = arguments[3];
+    std::replace(format.begin(), format.end(), ':', '\t');
+    TOpCounter counter;
+    {
+        std::unique_lock<std::mutex> ingestGuard(dataset->IngestLock);
+        dataset->Online->CalculateCounter(atof(arguments[2].c_str()), dataset->Config.Alpha, counter);
+    }
+    std::string line;
+    counter.GetLine(format, line);
+    return "OK\n" + line + "\n";
+}
+
+int RunClient(const std::string& socketPath, const std::string& command, std::istream* body) {
+    sockaddr_un address = SocketAddress(socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd < 0) || (connect(fd, (const sockaddr*)&address, sizeof(address)) != 0)) {
+        std::cerr << "Can't connect to " << socketPath << std::endl;
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    std::string request = command + "\n";
+    if (body) {
+        std::ostringstream data;
+        data << body->rdbuf();
+        request += data.str();
+    }
+    std::string response;
+    bool done = WriteFrame(fd, request) && ReadFrame(fd, response);
+    close(fd);
+    if (!done) {
+        std::cerr << "Connection to " << socketPath << " is broken" << std::endl;
+        return 1;
+    }
+    if (response.compare(0, 3, "OK\n") == 0) {
+        std::cout << response.substr(3);
+        return 0;
+    }
+    std::cerr << response;
+    return 1;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "opfinder.h"
+#include "onlinecurve.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/*
+    Evaluation server keeping data sets resident between requests. Clients connect to a
+    Unix domain socket and exchange frames: 4 byte little-endian payload length followed
+    by the payload. Request payload is a command line ended with '\n' and an optional body,
+    response payload is "OK\n" followed by results or "ERROR message\n". Commands:
+        OPEN name actual predicted [pc=N] [nc=N] [C=N] [weight=N] [alpha=A] [bins=N] [range=MIN:MAX]
+                                creates an empty data set, replacing existing one
+        INGEST name             body is tab separated rows appended to the data set, the response
+                                is "Rejected lines\tN", rejected lines are reported to stderr
+        RETRACT name            body is rows to remove from a binned data set, e.g. ones leaving a window,
+                                the response is the same as the one of INGEST
+        AUC name                AUC, PR AUC and average precision
+        QUERY name              body is queries in --queries file format, results come as a table
+        PLOT name x y n [deviation]
+        METRICS name threshold format
+                                metrics of a binned data set at the threshold in --formatstring format
+        DROP name
+        LIST
+        STOP                    stops the server once running requests are answered
+    Every data set keeps only its curve. Ingested rows are read into a curve of their own,
+    which is merged into a new copy of the data set, so queries never wait for ingestion.
+    Binned data sets keep a TOnlineCurve instead, rows are added to or removed from it one by
+    one in O(log bins) and nothing else is recomputed, so updates don't depend on the data set
+    size. AUC and METRICS are answered by the online curve. QUERY, PLOT, PR AUC and average
+    precision need all bins anyway, they use a copy built from the bins in O(bins) once per change.
+    Connections are polled by a single thread and every request is a task of the thread pool,
+    so idle clients don't take threads and threads count limits requests executed at once.
+*/
+class TEvalServer {
+public:
+    TEvalServer(const std::string& socketPath, size_t threads);
+    ~TEvalServer();
+
+    //Serves clients until STOP command
+    void Run();
+
+private:
+    struct TConfig {
+        size_t Actual;
+        size_t Predicted;
+        int Positive;
+        int Negative;
+        bool Fixed;
+        double Alpha;
+        bool Weighted;
+        size_t Weight;
+        size_t Bins;
+        double Min;
+        double Max;
+
+        TOpFinder CreateFinder() const;
+    };
+
+    struct TDataset {
+        TConfig Config;
+        std::shared_ptr<const TOpFinder> Finder;
+        std::unique_ptr<TOnlineCurve> Online;   //binned data sets only
+        bool Stale;                 //Online has changed since Finder was built from it
+        std::mutex IngestLock;      //ingestions of a data set are merged one by one, guards Online and Stale
+    };
+
+    TEvalServer(const TEvalServer&);
+    TEvalServer& operator=(const TEvalServer&);
+
+    //Answers a single request of the client and gives the connection back to the polling thread
+    void Serve(int client);
+    void WakeUp();
+    std::string Execute(const std::string& request);
+    std::shared_ptr<TDataset> GetDataset(const std::string& name);
+    std::shared_ptr<const TOpFinder> GetFinder(TDataset& dataset);
+    //Rebuilds the copy of a binned data set if its online curve has changed, IngestLock should be held
+    void Refresh(TDataset& dataset);
+
+    std::string Open(const std::vector<std::string>& arguments);
+    std::string Ingest(const std::string& name, const char* begin, const char* end, bool remove);
+    std::string Metrics(const std::string& name, const std::vector<std::string>& arguments);
+
+    std::string SocketPath;
+    size_t Threads;
+    int Listener;
+    int WakeUpPipe[2];          //written to stop polling for connections given back or for STOP
+    bool Stopping;
+    std::vector<int> Returned;  //connections served since the last poll
+    std::map<std::string, std::shared_ptr<TDataset> > Datasets;
+    std::mutex Lock;
+};
+
+//Sends a single request and prints the response, returns process exit code
+int RunClient(const std::string& socketPath, const std::string& command, std::istream* body);
@@ -0,0 +1,43 @@
+#include "stats.h"
+
+#include <sys/resource.h>
+
+std::atomic<bool> TStats::IsEnabled(false);
+std::atomic<uint64_t> TStats::Times[TStats::PhaseCount];
+std::atomic<uint64_t> TStats::Calls[TStats::PhaseCount];
+std::atomic<uint64_t> TStats::Counters[TStats::CounterCount];
+
+static const char* PHASE_NAMES[TStats::PhaseCount] = {
+    "parse", "sort", "curve", "merge", "calculate", "optimize", "bootstrap", "output", "plot"
+};
+
+static const char* COUNTER_NAMES[TStats::CounterCount] = {
+    "lines_read", "lines_rejected", "bytes_parsed", "records_kept", "distinct_thresholds", "output_bytes"
+};
+
+void TStats::Enable() {
+    IsEnabled.store(true, std::memory_order_relaxed);
+}
+
+void TStats::AddTime(Phase phase, uint64_t nanoseconds) {
+    Times[phase].fetch_add(nanoseconds, std::memory_order_relaxed);
+    Calls[phase].fetch_add(1, std::memory_order_relaxed);
+}
+
+void TStats::Write(std::ostream& out) {
+    out << "{\"phases\": {";
+    bool first = true;
+    for (size_t i = 0; i < PhaseCount; ++i) {
+        if (!Calls[i].load())
+            continue;
+        out << (first ? "" : ", ") << "\"" << PHASE_NAMES[i] << "\": {\"seconds\": " << Times[i].load() / 1e9
+            << ", \"calls\": " << Calls[i].load() << "}";
+        first = false;
+    }
+    out << "}, \"counters\": {";
+    for (size_t i = 0; i < CounterCount; ++i)
+        out << (i ? ", " : "") << "\"" << COUNTER_NAMES[i] << "\": " << Counters[i].load();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    out << "}, \"peak_rss_kb\": " << usage.ru_maxrss << "}" << std::endl;
+}
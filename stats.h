@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+/*
+    Process wide statistics of a run for --stats: time spent in phases of TOpFinder and
+    counters of processed data. Everything is disabled by default, then a timer costs a
+    check of a flag and counters aren't touched, so instrumentation stays in release builds.
+    Counters are added per chunk or per call rather than per record. Phases running on
+    several threads at once, e.g. sorting of columns, sum up times of all threads.
+*/
+class TStats {
+public:
+    enum Phase {
+        Parse = 0,
+        Sort,
+        Curve,
+        Merge,
+        Calculate,
+        Optimize,
+        Bootstrap,
+        Output,
+        Plot,
+        PhaseCount
+    };
+
+    enum Counter {
+        LinesRead = 0,
+        LinesRejected,
+        BytesParsed,
+        RecordsKept,
+        DistinctThresholds,
+        OutputBytes,
+        CounterCount
+    };
+
+    static void Enable();
+    static bool Enabled() {
+        return IsEnabled.load(std::memory_order_relaxed);
+    }
+    static void Add(Counter counter, uint64_t value) {
+        if (Enabled())
+            Counters[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+    static void AddTime(Phase phase, uint64_t nanoseconds);
+    //JSON object of phase times, counters and peak RSS
+    static void Write(std::ostream& out);
+
+private:
+    static std::atomic<bool> IsEnabled;
+    static std::atomic<uint64_t> Times[PhaseCount];
+    static std::atomic<uint64_t> Calls[PhaseCount];
+    static std::atomic<uint64_t> Counters[CounterCount];
+};
+
+//Adds time of the scope to the phase
+class TStatsTimer {
+public:
+    explicit TStatsTimer(TStats::Phase phase)
+        : CurrentPhase(phase)
+        , Running(TStats::Enabled())
+    {
+        if (Running)
+            Start = std::chrono::steady_clock::now();
+    }
+
+    ~TStatsTimer() {
+        if (Running)
+            TStats::AddTime(CurrentPhase, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - Start).count());
+    }
+
+private:
+    TStatsTimer(const TStatsTimer&);
+    TStatsTimer& operator=(const TStatsTimer&);
+
+    TStats::Phase CurrentPhase;
+    bool Running;
+    std::chrono::steady_clock::time_point Start;
+};
@@ -0,0 +1,69 @@
+#include "threadpool.h"
+
+TThreadPool::TThreadPool(size_t threadCount)
+    : Running(0)
+    , Stopping(false)
+{
+    if (threadCount > 1) {
+        for (size_t i = 0; i < threadCount; ++i)
+            Workers.push_back(std::thread(&TThreadPool::WorkerLoop, this));
+    }
+}
+
+TThreadPool::~TThreadPool() {
+    {
+        std::unique_lock<std::mutex> guard(Lock);
+        Stopping = true;
+    }
+    TaskAdded.notify_all();
+    for (size_t i = 0; i < Workers.size(); ++i)
+        Workers[i].join();
+}
+
+void TThreadPool::Add(const std::function<void()>& task) {
+    if (Workers.empty()) {
+        task();
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> guard(Lock);
+        Tasks.push_back(task);
+    }
+    TaskAdded.notify_one();
+}
+
+void TThreadPool::Wait() {
+    std::unique_lock<std::mutex> guard(Lock);
+    while (!Tasks.empty() || Running)
+        TaskDone.wait(guard);
+}
+
+size_t TThreadPool::Size() const {
+    return Workers.empty() ? 1 : Workers.size();
+}
+
+size_t TThreadPool::ThreadCount(size_t requested) {
+    if (requested)
+        return requested;
+    size_t cores = std::thread::hardware_concurrency();
+    return cores ? cores : 1;
+}
+
+void TThreadPool::WorkerLoop() {
+    std::unique_lock<std::mutex> guard(Lock);
+    while (true) {
+        while (Tasks.empty() && !Stopping)
+            TaskAdded.wait(guard);
+        if (Tasks.empty())
+            return;
+        std::function<void()> task = Tasks.front();
+        Tasks.pop_front();
+        ++Running;
+        guard.unlock();
+        task();
+        guard.lock();
+        --Running;
+        if (Tasks.empty() && !Running)
+            TaskDone.notify_all();
+    }
+}
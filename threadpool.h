@@ -0,0 +1,37 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed size pool of worker threads. Pool of a single thread doesn't start any
+//workers and runs tasks right in Add, so single threaded runs have no overhead.
+class TThreadPool {
+public:
+    explicit TThreadPool(size_t threadCount);
+    ~TThreadPool();
+
+    void Add(const std::function<void()>& task);
+    void Wait();
+    size_t Size() const;
+
+    //0 means all available cores
+    static size_t ThreadCount(size_t requested);
+
+private:
+    TThreadPool(const TThreadPool&);
+    TThreadPool& operator=(const TThreadPool&);
+
+    void WorkerLoop();
+
+    std::vector<std::thread> Workers;
+    std::deque<std::function<void()> > Tasks;
+    std::mutex Lock;
+    std::condition_variable TaskAdded;
+    std::condition_variable TaskDone;
+    size_t Running;
+    bool Stopping;
+};